@@ -0,0 +1,53 @@
+#ifndef __aligned_allocator_h
+#define __aligned_allocator_h
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Cache line size, and the widest SIMD register we care about (AVX-512).
+const size_t CACHE_LINE_SIZE = 64;
+
+// std::allocator replacement that hands out memory aligned to ALIGNMENT bytes.
+template<typename T, size_t ALIGNMENT = CACHE_LINE_SIZE>
+struct aligned_allocator {
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef aligned_allocator<U, ALIGNMENT> other;
+    };
+
+    aligned_allocator() noexcept {
+    }
+
+    template<typename U>
+    aligned_allocator(const aligned_allocator<U, ALIGNMENT>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        if (n == 0)
+            return nullptr;
+
+        void* p = nullptr;
+        if (posix_memalign(&p, ALIGNMENT, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return (T*) p;
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        free(p);
+    }
+};
+
+template<typename T, typename U, size_t ALIGNMENT>
+bool operator==(const aligned_allocator<T, ALIGNMENT>&, const aligned_allocator<U, ALIGNMENT>&) {
+    return true;
+}
+
+template<typename T, typename U, size_t ALIGNMENT>
+bool operator!=(const aligned_allocator<T, ALIGNMENT>&, const aligned_allocator<U, ALIGNMENT>&) {
+    return false;
+}
+
+#endif
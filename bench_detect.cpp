@@ -0,0 +1,803 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "detector.h"
+#include "grouping.h"
+#include "tiled_detector.h"
+#include "video_detector.h"
+#include "motion_gate.h"
+#include "detection_mask.h"
+#include "utils.h"
+
+#include "test_synthetic_data.cpp"
+
+using namespace std;
+
+static const char* mode_name(detect_mode mode) {
+    switch (mode) {
+        case DETECT_SCALE_FEATURES:
+            return "scale-features";
+        case DETECT_PYRAMID:
+            return "pyramid";
+        case DETECT_HYBRID:
+            return "hybrid";
+        default:
+            break;
+    }
+    return "?";
+}
+
+// Scene with checkers planted at a spread of sizes.
+static image<double> bench_scene(uint16_t w, uint16_t h) {
+    auto lum = synthetic_scene(w, h, w * h);
+    for (uint16_t size = 24, x = 8; x + size * 2 < w && size * 2 < h; x += size + 8, size += size / 2)
+        plant_checker(lum, x, h / 2 - size / 2, size);
+    return lum;
+}
+
+// Whether some detection is centered in the size x size object at (x, y).
+static bool found_center(const vector<detection>& ds, uint32_t x, uint32_t y, uint16_t size) {
+    for (auto& d : ds)
+        if (d.x + d.w / 2 >= x && d.x + d.w / 2 < x + size && d.y + d.h / 2 >= y && d.y + d.h / 2 < y + size)
+            return true;
+    return false;
+}
+
+template<typename F>
+static double ms_per_call(F f, int calls) {
+    f(); // warm up, and size any buffers
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i)
+        f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, milli>(end - start).count() / calls;
+}
+
+static void bench_modes(const cascade_classifier& cc) {
+    printf("detection modes\n");
+
+    struct {
+        uint16_t w;
+        uint16_t h;
+    } sizes[] = {
+        {320, 240},
+        {640, 480},
+        {1280, 720}
+    };
+
+    for (auto& sz : sizes) {
+        auto lum = bench_scene(sz.w, sz.h);
+
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            detector d(cc, params);
+            size_t n = 0;
+            double ms = ms_per_call([&]() {
+                n = d.detect(lum).size();
+            }, 5);
+            printf("  %4ux%-4u %-16s %9.2f ms/frame %6lu detections\n", sz.w, sz.h, mode_name(mode), ms, n);
+        }
+    }
+}
+
+// Single threaded detection with each cascade evaluation kernel, depth and
+// breadth first.
+static void bench_simd(const cascade_classifier& cc) {
+    printf("cascade evaluation kernels\n");
+
+    const simd_level levels[] = {SIMD_NONE, SIMD_AVX2, SIMD_AVX512};
+    const char* levelNames[] = {"scalar", "avx2 x8", "avx512 x16"};
+    simd_level supported = simd_supported();
+
+    for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID}) {
+        auto lum = bench_scene(1280, 720);
+
+        for (auto order : {DETECT_DEPTH_FIRST, DETECT_BREADTH_FIRST}) {
+            detect_params params;
+            params.mode = mode;
+            params.order = order;
+            detector d(cc, params);
+
+            for (int l = 0; l < 3; ++l) {
+                if (levels[l] > supported)
+                    continue;
+                simd_set_limit(levels[l]);
+                size_t n = 0;
+                double ms = ms_per_call([&]() {
+                    n = d.detect(lum).size();
+                }, 5);
+                printf("  1280x720 %-16s %-14s %-12s %9.2f ms/frame %6lu detections\n", mode_name(mode),
+                        (order == DETECT_DEPTH_FIRST) ? "depth first" : "breadth first", levelNames[l], ms, n);
+            }
+            simd_set_limit(supported);
+        }
+    }
+}
+
+// Coarse to fine against the exhaustive scan: time per frame and how many of
+// the planted objects are still found (a detection centered within an eighth
+// of the object size, with a window within a quarter of it).
+struct planted {
+    uint16_t x;
+    uint16_t y;
+    uint16_t size;
+};
+
+// Plant count checkers of random sizes that do not touch into lum.
+static vector<planted> plant_objects(image<double>& lum, size_t count) {
+    vector<planted> objects;
+    uint32_t seed = 7;
+    while (objects.size() < count) {
+        seed = seed * 1664525 + 1013904223;
+        uint16_t size = 24 + (seed >> 8) % 72;
+        uint16_t x = (seed >> 4) % (lum.w - size);
+        seed = seed * 1664525 + 1013904223;
+        uint16_t y = (seed >> 4) % (lum.h - size);
+
+        bool overlaps = false;
+        for (auto& o : objects)
+            overlaps = overlaps || (x < o.x + o.size + 8 && o.x < x + size + 8 && y < o.y + o.size + 8 && o.y < y + size + 8);
+        if (!overlaps) {
+            plant_checker(lum, x, y, size);
+            objects.push_back(planted{x, y, size});
+        }
+    }
+    return objects;
+}
+
+static void bench_coarse(const cascade_classifier& cc) {
+    printf("coarse to fine recall, 1280x720, 40 planted objects\n");
+
+    auto lum = synthetic_scene(1280, 720, 99);
+    auto objects = plant_objects(lum, 40);
+
+    struct {
+        uint16_t coarseStep;
+        uint16_t refineStages;
+    } configs[] = {
+        {1, 1},
+        {2, 1},
+        {2, 2},
+        {3, 1},
+        {3, 2},
+        {4, 1},
+        {4, 2}
+    };
+
+    double exhaustiveMs = 0;
+    for (auto& config : configs) {
+        detect_params params;
+        params.coarseStep = config.coarseStep;
+        params.refineStages = config.refineStages;
+        detector d(cc, params);
+
+        size_t n = 0;
+        double ms = ms_per_call([&]() {
+            n = d.detect(lum).size();
+        }, 3);
+        if (config.coarseStep == 1)
+            exhaustiveMs = ms;
+
+        size_t hits = 0;
+        for (auto& o : objects) {
+            for (auto& det : d.detect(lum)) {
+                int dx = (det.x + det.w / 2) - (o.x + o.size / 2);
+                int dy = (det.y + det.h / 2) - (o.y + o.size / 2);
+                if (abs(dx) <= o.size / 8 && abs(dy) <= o.size / 8 && abs(det.w - o.size) <= o.size / 4) {
+                    ++hits;
+                    break;
+                }
+            }
+        }
+
+        if (config.coarseStep == 1)
+            printf("  %-26s", "exhaustive");
+        else printf("  coarse %u, refine after %u  ", config.coarseStep, config.refineStages);
+        printf("%9.2f ms/frame %5.2fx  recall %5.1f%% %6lu detections\n", ms, exhaustiveMs / ms,
+                100.0 * hits / objects.size(), n);
+    }
+}
+
+// Latency of one large frame as threads are added. Scaling is capped by the
+// cores of the machine running the bench.
+// Stages of one discriminating stump followed by many weak random ones, the
+// shape of late stages of a trained cascade: most windows are lost after the
+// first stump but a hard stage still sums all of them.
+static cascade_classifier long_cascade(const vector<image_view<const double>>& positives) {
+    auto features = generate_feature_set(SYNTHETIC_BASE_RES);
+    cascade_classifier cc(SYNTHETIC_BASE_RES);
+    uint32_t seed = 3;
+    for (double threshold : {48.0, 200.0, 250.0}) {
+        vector<weak_classifier> wcs{weak_classifier(feature_create(D, 0, 0, 24, 24), threshold, false)};
+        vector<double> weights{4.0};
+        for (int i = 0; i < 60; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            const feature& f = features[(seed >> 8) % features.size()];
+            wcs.push_back(weak_classifier(f, ((int) ((seed >> 4) & 0xf) - 8) * 0.1, (seed & 1) != 0));
+            weights.push_back(0.05);
+        }
+        strong_classifier sc(wcs, weights, 0.0);
+        sc.optimize_threshold(positives, 0.0);
+        cc.push_back(sc);
+    }
+    return cc;
+}
+
+static void bench_soft() {
+    printf("soft cascade, 61 weak classifiers per stage, 640x480\n");
+
+    // checkers with a little misalignment and scale change as positives
+    vector<image<double>> owned;
+    for (uint16_t size = 22; size <= 26; ++size) {
+        auto lum = synthetic_scene(32, 32, size);
+        plant_checker(lum, 4, 4, size);
+        for (uint16_t y = 2; y <= 6; ++y)
+            for (uint16_t x = 2; x <= 6; ++x)
+                owned.push_back(image_integral(image_normalize(image_roi(lum, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES))));
+    }
+    vector<image_view<const double>> positives(owned.begin(), owned.end());
+
+    auto hard = long_cascade(positives);
+    auto soft = hard;
+    soft.calibrate_rejection(positives);
+    auto lum = bench_scene(640, 480);
+
+    for (auto c : {&hard, &soft}) {
+        detector d(*c, detect_params());
+        size_t n = 0;
+        double ms = ms_per_call([&]() {
+            n = d.detect(lum).size();
+        }, 3);
+        printf("  %-8s %9.2f ms/frame %6lu detections, fnr %.3f\n", c == &hard ? "hard" : "soft", ms, n, c->fnr(positives));
+    }
+}
+
+// Hits clustered around objects spread over a 4K frame, about 100 per object
+// like a multi-scale scan gives.
+static vector<detection> bench_hits(size_t n) {
+    vector<detection> ds;
+    uint32_t seed = 11;
+    while (ds.size() < n) {
+        seed = seed * 1664525 + 1013904223;
+        uint16_t size = 24 + (seed >> 8) % 64;
+        uint16_t x = (seed >> 4) % (3840 - size - 16);
+        seed = seed * 1664525 + 1013904223;
+        uint16_t y = (seed >> 4) % (2160 - size - 16);
+        for (int i = 0; i < 100 && ds.size() < n; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            uint16_t s = size + (seed >> 8) % (size / 8 + 1);
+            ds.push_back(detection{(uint16_t) (x + (seed >> 4) % 16), (uint16_t) (y + (seed >> 12) % 16), s, s, 0});
+        }
+    }
+    return ds;
+}
+
+static void bench_grouping() {
+    printf("grouping, hits in clusters of 100\n");
+    for (size_t n : {1000, 10000, 100000}) {
+        auto ds = bench_hits(n);
+        int calls = (n <= 10000) ? 20 : 3;
+        printf("  %6lu hits", n);
+
+        for (auto method : {GROUP_NEIGHBORS, GROUP_NMS}) {
+            group_params params;
+            params.method = method;
+            detection_grouper grouper(params);
+            size_t groups = 0;
+            double ms = ms_per_call([&]() {
+                groups = grouper.group(ds).size();
+            }, calls);
+            printf("  %s %8.3f ms (%lu groups)", method == GROUP_NMS ? "nms" : "neighbors", ms, groups);
+        }
+
+        // what finding the overlapping pairs costs comparing all of them
+        if (n <= 10000) {
+            size_t pairs = 0;
+            double ms = ms_per_call([&]() {
+                pairs = 0;
+                for (size_t i = 0; i < ds.size(); ++i)
+                    for (size_t j = i + 1; j < ds.size(); ++j)
+                        pairs += detection_iou(ds[i], ds[j]) >= 0.3;
+            }, 3);
+            printf("  all pairs %9.3f ms", ms);
+        }
+        printf("\n");
+    }
+}
+
+// What tiling costs: the overlap is scanned twice and every tile pays for its
+// own integrals, in exchange memory stays at a tile's worth.
+static void bench_tiled(const cascade_classifier& cc) {
+    printf("tiled detection, 3840x2160, windows up to 128\n");
+    auto lum = bench_scene(3840, 2160);
+    detect_params params;
+    params.maxWindow = 128;
+
+    detector d(cc, params);
+    size_t n = 0;
+    double ms = ms_per_call([&]() {
+        n = d.detect(lum).size();
+    }, 3);
+    printf("  %-10s %9.2f ms/frame %6lu detections\n", "whole", ms, n);
+
+    for (uint16_t tileSize : {512, 1024, 2048}) {
+        tile_params tiles;
+        tiles.tileSize = tileSize;
+        tiles.maxWindow = 128;
+        tiled_detector td(cc, params, tiles);
+        auto reader = [&](uint32_t x, uint32_t y, const image_view<double>& tile) {
+            image_blit(image_roi(lum, (uint16_t) x, (uint16_t) y, tile.w, tile.h), tile);
+        };
+        ms = ms_per_call([&]() {
+            n = td.detect(lum.w, lum.h, reader).size();
+        }, 3);
+        printf("  tiles %4u %9.2f ms/frame %6lu detections, tile integrals %5.1f MB\n", tileSize, ms, n,
+                3.0 * tileSize * tileSize * sizeof (double) / (1 << 20));
+    }
+}
+
+// Following objects between keyframes against grouping a full scan of every
+// frame, on objects drifting a few pixels a frame. Recall counts the frames
+// and objects with a group centered in the object.
+static void bench_video(const cascade_classifier& cc) {
+    printf("video tracking, 1280x720, 8 moving objects, 30 frames\n");
+
+    struct planted {
+        uint16_t x;
+        uint16_t y;
+        uint16_t size;
+        int16_t dx;
+        int16_t dy;
+    };
+    vector<planted> objects;
+    for (uint16_t i = 0; i < 8; ++i)
+        objects.push_back(planted{(uint16_t) (100 + 140 * i), (uint16_t) (150 + 50 * (i % 4)), (uint16_t) (24 + 8 * i),
+            (int16_t) (i % 3 - 1), (int16_t) (2 - i % 5)});
+
+    const int frames = 30;
+    auto background = synthetic_scene(1280, 720, 11);
+    auto lum = image_create<double>(1280, 720);
+    auto render = [&](int t) {
+        image_blit(image_roi(background, 0, 0, background.w, background.h), image_view<double>(lum));
+        for (auto& o : objects)
+            plant_checker(lum, o.x + o.dx * t, o.y + o.dy * t, o.size);
+    };
+    auto recalled = [&](const vector<detection_group>& groups, int t) {
+        size_t n = 0;
+        for (auto& o : objects) {
+            int64_t x = o.x + o.dx * t, y = o.y + o.dy * t;
+            for (auto& g : groups) {
+                int64_t cx = g.rect.x + g.rect.w / 2, cy = g.rect.y + g.rect.h / 2;
+                if (cx >= x && cx < x + o.size && cy >= y && cy < y + o.size) {
+                    ++n;
+                    break;
+                }
+            }
+        }
+        return n;
+    };
+
+    detector d(cc);
+    detection_grouper grouper;
+    double ms = 0;
+    size_t hits = 0;
+    for (int t = 0; t < frames; ++t) {
+        render(t);
+        auto start = chrono::steady_clock::now();
+        auto& groups = grouper.group(d.detect(lum));
+        ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        hits += recalled(groups, t);
+    }
+    double fullMs = ms / frames;
+    printf("  %-14s %9.2f ms/frame         recall %5.3f\n", "full scans", fullMs, (double) hits / (frames * objects.size()));
+
+    for (unsigned interval : {5u, 10u, 30u}) {
+        video_params video;
+        video.keyframeInterval = interval;
+        video_detector vd(cc, detect_params(), video);
+        ms = 0;
+        hits = 0;
+        for (int t = 0; t < frames; ++t) {
+            render(t);
+            auto start = chrono::steady_clock::now();
+            auto& groups = vd.detect(lum);
+            ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            hits += recalled(groups, t);
+        }
+        ms /= frames;
+        printf("  keyframes %-4u %9.2f ms/frame %5.2fx recall %5.3f, %lu full scans\n", interval, ms, fullMs / ms,
+                (double) hits / (frames * objects.size()), vd.full_scans());
+    }
+}
+
+// A fixed camera: static background, two objects walking across it. Gated
+// scans only classify windows over blocks that changed.
+static void bench_motion(const cascade_classifier& cc) {
+    printf("motion gating, 1280x720, 2 moving objects, 20 frames\n");
+
+    const int frames = 20;
+    auto background = synthetic_scene(1280, 720, 12);
+    auto lum = image_create<double>(1280, 720);
+    auto render = [&](int t) {
+        image_blit(image_roi(background, 0, 0, background.w, background.h), image_view<double>(lum));
+        plant_checker(lum, (uint16_t) (100 + 6 * t), 200, 48);
+        plant_checker(lum, (uint16_t) (900 - 4 * t), (uint16_t) (400 + 2 * t), 64);
+    };
+    auto recalled = [&](const vector<detection>& ds, int t) {
+        return (size_t) found_center(ds, 100 + 6 * t, 200, 48) + found_center(ds, 900 - 4 * t, 400 + 2 * t, 64);
+    };
+
+    struct {
+        const char* name;
+        bool gated;
+        double backgroundRate;
+    } configs[] = {
+        {"ungated", false, 0.0},
+        {"last frame", true, 0.0},
+        {"background", true, 0.05}
+    };
+
+    double ungatedMs = 0;
+    for (auto& config : configs) {
+        detector d(cc);
+        motion_params params;
+        params.backgroundRate = config.backgroundRate;
+        motion_gate motion(params);
+
+        double ms = 0;
+        size_t hits = 0;
+        double moving = 0;
+        for (int t = 0; t < frames; ++t) {
+            render(t);
+            auto start = chrono::steady_clock::now();
+            auto& ds = config.gated ? d.detect(lum, motion.update(lum)) : d.detect(lum);
+            // the first frame is open everywhere either way
+            if (t > 0)
+                ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            hits += recalled(ds, t);
+            moving += motion.moving();
+        }
+        ms /= frames - 1;
+        if (!config.gated)
+            ungatedMs = ms;
+        printf("  %-10s %9.2f ms/frame %5.2fx recall %5.3f", config.name, ms, ungatedMs / ms, (double) hits / (2 * frames));
+        if (config.gated)
+            printf(", %4.1f%% of blocks moving", 100.0 * moving / frames);
+        printf("\n");
+    }
+}
+
+// Restricting detection to part of the frame: a doorway rectangle, and a
+// pixel mask of two lanes, against scanning the whole frame.
+static void bench_masks(const cascade_classifier& cc) {
+    printf("detection masks, 1280x720\n");
+    auto lum = bench_scene(1280, 720);
+    detector d(cc);
+
+    size_t n = 0;
+    double whole = ms_per_call([&]() {
+        n = d.detect(lum).size();
+    }, 3);
+    printf("  %-10s %9.2f ms/frame         %6lu detections\n", "whole", whole, n);
+
+    detection_mask doorway;
+    doorway.set_rois(lum.w, lum.h, {detection{480, 120, 320, 480, 0}});
+
+    auto lanes = image_create_padded<uint8_t>(lum.w, lum.h);
+    image_view<uint8_t> l(lanes);
+    for (uint16_t y = 0; y < l.h; ++y)
+        for (uint16_t x = 0; x < l.w; ++x)
+            l.at(x, y) = (abs((int) x - 2 * (int) y / 3 - 200) < 60 || abs((int) x + 2 * (int) y / 3 - 1100) < 60) ? 1 : 0;
+    detection_mask mask(4, 0.9);
+    mask.set_mask(lanes);
+
+    for (auto& m : {make_pair("doorway", &doorway), make_pair("lanes", &mask)}) {
+        double ms = ms_per_call([&]() {
+            n = detect_masked(d, lum, *m.second).size();
+        }, 3);
+        printf("  %-10s %9.2f ms/frame %5.2fx %6lu detections\n", m.first, ms, whole / ms, n);
+    }
+}
+
+// Anytime detection under a time budget, on the frame after a full scan so
+// the scales that found objects go first. Recall counts the planted objects
+// with a detection centered in them.
+static void bench_anytime(const cascade_classifier& cc) {
+    printf("anytime detection, 1280x720, 40 planted objects\n");
+
+    auto lum = synthetic_scene(1280, 720, 99);
+    auto objects = plant_objects(lum, 40);
+    auto recall = [&](const vector<detection>& ds) {
+        size_t hits = 0;
+        for (auto& o : objects)
+            hits += found_center(ds, o.x, o.y, o.size);
+        return (double) hits / objects.size();
+    };
+
+    detector d(cc);
+    size_t n = 0;
+    double full = ms_per_call([&]() {
+        n = d.detect(lum).size();
+    }, 3);
+    printf("  %-10s %9.2f ms/frame          recall %5.3f\n", "full", full, recall(d.detect(lum)));
+
+    for (double budgetMs : {2.0, 5.0, 10.0, 20.0}) {
+        detect_budget budget;
+        budget.milliseconds = budgetMs;
+        d.begin(lum);
+        while (!d.resume(1 << 16)) {
+        }
+        double r = 0;
+        double ms = ms_per_call([&]() {
+            r = recall(d.detect(lum, budget));
+        }, 5);
+        printf("  %5.0f ms   %9.2f ms/frame %5.1f%% scanned, recall %5.3f\n", budgetMs, ms, 100.0 * d.progress(), r);
+    }
+}
+
+// Throughput of batches against one frame per call. A batch costs two pool
+// dispatches and keeps every scale's cascade hot across its frames; latency
+// is a whole batch.
+static void bench_batch(const cascade_classifier& cc) {
+    printf("batches, 640x480, %u hardware threads\n", thread::hardware_concurrency());
+
+    vector<image<double>> owned;
+    for (uint32_t seed = 0; seed < 16; ++seed) {
+        owned.push_back(synthetic_scene(640, 480, 30 + seed));
+        plant_objects(owned.back(), 8);
+    }
+    vector<image_view<const double>> frames(owned.begin(), owned.end());
+
+    for (unsigned threads : {1u, 4u}) {
+        detect_params params;
+        params.threads = threads;
+        detector d(cc, params);
+
+        double ms = ms_per_call([&]() {
+            for (auto& frame : frames)
+                d.detect(frame);
+        }, 3);
+        printf("  %u threads, %-8s %8.1f frames/s %9.2f ms latency\n", threads, "single", 1000.0 * frames.size() / ms, ms / frames.size());
+
+        for (size_t size : {4, 8, 16}) {
+            ms = ms_per_call([&]() {
+                for (size_t f = 0; f < frames.size(); f += size)
+                    d.detect(vector<image_view<const double>>(frames.begin() + f, frames.begin() + f + size));
+            }, 3);
+            printf("  %u threads, batch %-2lu %8.1f frames/s %9.2f ms latency\n", threads, size, 1000.0 * frames.size() / ms, ms * size / frames.size());
+        }
+    }
+}
+
+static void bench_views(const cascade_classifier& cc) {
+    printf("views (upright, 90, 180 and 270 degrees), 640x480\n");
+
+    auto lum = bench_scene(640, 480);
+    vector<view_transform> turns = {VIEW_IDENTITY, VIEW_ROTATE_90, VIEW_ROTATE_180, VIEW_ROTATE_270};
+    vector<cascade_classifier> views;
+    for (auto t : turns)
+        views.push_back(cc.transformed(t));
+
+    for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID}) {
+        detect_params params;
+        params.mode = mode;
+
+        // the frame turned and scanned once per view, the way it is done
+        // without views
+        detector upright(cc, params), sideways(cc, params);
+        double rotated = ms_per_call([&]() {
+            upright.detect(lum);
+            sideways.detect(image_rotate_90(lum));
+            upright.detect(image_rotate_180(lum));
+            sideways.detect(image_rotate_270(lum));
+        }, 5);
+
+        vector<unique_ptr<detector>> separate;
+        for (auto& view : views)
+            separate.push_back(unique_ptr<detector>(new detector(view, params)));
+        double apart = ms_per_call([&]() {
+            for (auto& d : separate)
+                d->detect(lum);
+        }, 5);
+
+        detector shared(views, params);
+        double together = ms_per_call([&]() {
+            shared.detect(lum);
+        }, 5);
+
+        printf("  %-15s rotated frames %7.2f ms, one detector per view %7.2f ms, shared %7.2f ms (%.2fx, %.2fx)\n",
+                mode_name(mode), rotated, apart, together, rotated / together, apart / together);
+    }
+}
+
+static void bench_bytes(const cascade_classifier& cc) {
+    printf("8 bit frames with padded rows, pyramid\n");
+
+    for (auto size : {make_pair(640, 480), make_pair(1920, 1080)}) {
+        uint16_t w = (uint16_t) size.first, h = (uint16_t) size.second;
+        auto lum = bench_scene(w, h);
+        size_t stride = w + 64;
+        vector<uint8_t> buffer(stride * h);
+        for (uint16_t y = 0; y < h; ++y)
+            for (uint16_t x = 0; x < w; ++x)
+                buffer[y * stride + x] = (uint8_t) image_view<const double>(lum).at(x, y);
+
+        detect_params params;
+        params.mode = DETECT_PYRAMID;
+        detector d(cc, params);
+
+        // what callers had to do: pack into ARGB and convert back
+        auto argb = image_create<uint32_t>(w, h);
+        double converted = ms_per_call([&]() {
+            for (uint16_t y = 0; y < h; ++y)
+                for (uint16_t x = 0; x < w; ++x)
+                    argb.bits[y * argb.stride + x] = buffer[y * stride + x] * 0x01010101u;
+            d.detect(image_argb_to_lum<double>(argb));
+        }, 5);
+
+        auto copy = image_create_padded<double>(w, h);
+        double copied = ms_per_call([&]() {
+            for (uint16_t y = 0; y < h; ++y)
+                copy_n(buffer.data() + y * stride, w, copy.bits.data() + y * copy.stride);
+            d.detect(copy);
+        }, 5);
+
+        double direct = ms_per_call([&]() {
+            d.detect(buffer.data(), w, h, stride);
+        }, 5);
+
+        printf("  %4ux%-4u via ARGB %7.2f ms, copied to doubles %7.2f ms, direct %7.2f ms (%.2fx, %.2fx)\n",
+                w, h, converted, copied, direct, converted / direct, copied / direct);
+    }
+}
+
+static void bench_threads(const cascade_classifier& cc) {
+    printf("threads, 3840x2160, %u hardware threads\n", thread::hardware_concurrency());
+
+    auto lum = bench_scene(3840, 2160);
+    double single = 0;
+
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u, 32u}) {
+        detect_params params;
+        params.threads = threads;
+        detector d(cc, params);
+        size_t n = 0;
+        double ms = ms_per_call([&]() {
+            n = d.detect(lum).size();
+        }, 2);
+        if (threads == 1)
+            single = ms;
+        printf("  %2u threads %9.2f ms/frame %5.2fx %6lu detections\n", threads, ms, single / ms, n);
+    }
+}
+
+static void bench_downscale() {
+    printf("luminance downscaling, 1280x720\n");
+
+    auto lumd = synthetic_scene(1280, 720, 7);
+    auto lumf = image_create_padded<float>(1280, 720);
+    auto lum8 = image_create_padded<uint8_t>(1280, 720);
+    for (uint16_t y = 0; y < 720; ++y) {
+        for (uint16_t x = 0; x < 1280; ++x) {
+            lumf.bits[(y * lumf.stride) + x] = (float) lumd.bits[(y * lumd.stride) + x];
+            lum8.bits[(y * lum8.stride) + x] = (uint8_t) lumd.bits[(y * lumd.stride) + x];
+        }
+    }
+
+    auto outd = image_create_padded<double>(1024, 576);
+    auto outf = image_create_padded<float>(1024, 576);
+    auto out8 = image_create_padded<uint8_t>(1024, 576);
+    auto plan = image_area_plan_create(1280, 720, 1024, 576);
+
+    printf("  %-34s %8.3f ms\n", "bilinear 1.25x (double)", ms_per_call([&]() {
+        image_resize_lum(image_view<const double>(lumd), image_view<double>(outd));
+    }, 20));
+    printf("  %-34s %8.3f ms\n", "area 1.25x (double)", ms_per_call([&]() {
+        image_downscale_area(image_view<const double>(lumd), image_view<double>(outd), plan);
+    }, 20));
+    printf("  %-34s %8.3f ms\n", "area 1.25x (float)", ms_per_call([&]() {
+        image_downscale_area(image_view<const float>(lumf), image_view<float>(outf), plan);
+    }, 20));
+    printf("  %-34s %8.3f ms\n", "area 1.25x (uint8)", ms_per_call([&]() {
+        image_downscale_area(image_view<const uint8_t>(lum8), image_view<uint8_t>(out8), plan);
+    }, 20));
+
+    auto halfd = image_create_padded<double>(640, 360);
+    auto halff = image_create_padded<float>(640, 360);
+    auto half8 = image_create_padded<uint8_t>(640, 360);
+    printf("  %-34s %8.3f ms\n", "2x box (double)", ms_per_call([&]() {
+        image_downscale_2x(image_view<const double>(lumd), image_view<double>(halfd));
+    }, 20));
+    printf("  %-34s %8.3f ms\n", "2x box (float)", ms_per_call([&]() {
+        image_downscale_2x(image_view<const float>(lumf), image_view<float>(halff));
+    }, 20));
+    printf("  %-34s %8.3f ms\n", "2x box (uint8)", ms_per_call([&]() {
+        image_downscale_2x(image_view<const uint8_t>(lum8), image_view<uint8_t>(half8));
+    }, 20));
+}
+
+// The float bilinear ARGB resize image_resize used before it went fixed
+// point, kept as the baseline.
+static void float_resize_argb(const image_view<const uint32_t>& input, const image_view<uint32_t>& output) {
+    float x_ratio = ((float) (input.w - 1)) / output.w;
+    float y_ratio = ((float) (input.h - 1)) / output.h;
+
+    for (int i = 0; i < output.h; i++) {
+        uint32_t* dst = output.row(i);
+        for (int j = 0; j < output.w; j++) {
+            int x = (int) (x_ratio * j);
+            int y = (int) (y_ratio * i);
+            float x_diff = (x_ratio * j) - x;
+            float y_diff = (y_ratio * i) - y;
+            const uint32_t* src = input.row(y) + x;
+            uint32_t a = src[0], b = src[1], c = src[input.stride], d = src[input.stride + 1];
+            uint32_t out = 0xff << 24;
+            for (int shift = 0; shift < 24; shift += 8) {
+                float v = ((a >> shift) & 0xff)*(1 - x_diff)*(1 - y_diff) + ((b >> shift) & 0xff)*(x_diff)*(1 - y_diff) +
+                        ((c >> shift) & 0xff)*(y_diff)*(1 - x_diff) + ((d >> shift) & 0xff)*(x_diff * y_diff);
+                out |= ((uint32_t) v) << shift;
+            }
+            *dst++ = out;
+        }
+    }
+}
+
+static void bench_resize() {
+    printf("argb bilinear resize\n");
+
+    const uint16_t sizes[][4] = {
+        {364, 243, 24, 24},
+        {640, 480, 64, 48},
+        {640, 480, 1280, 960},
+        {1920, 1080, 1280, 720}
+    };
+    const simd_level levels[] = {SIMD_NONE, SIMD_SSE2, SIMD_AVX2};
+    const char* levelNames[] = {"fixed point", "fixed point sse2", "fixed point avx2"};
+    simd_level supported = simd_supported();
+
+    for (auto& size : sizes) {
+        auto in = image_create_padded<uint32_t>(size[0], size[1]);
+        for (auto& v : in.bits)
+            v = (uint32_t) random();
+        auto out = image_create_padded<uint32_t>(size[2], size[3]);
+        int calls = max(5, 20000000 / (size[2] * size[3]));
+
+        printf("  %ux%u -> %ux%u\n", size[0], size[1], size[2], size[3]);
+        printf("    %-32s %8.3f ms\n", "float", ms_per_call([&]() {
+            float_resize_argb(image_view<const uint32_t>(in), image_view<uint32_t>(out));
+        }, calls));
+        for (int l = 0; l < 3; ++l) {
+            if (levels[l] > supported)
+                continue;
+            simd_set_limit(levels[l]);
+            printf("    %-32s %8.3f ms\n", levelNames[l], ms_per_call([&]() {
+                image_resize(image_view<const uint32_t>(in), image_view<uint32_t>(out));
+            }, calls));
+        }
+        simd_set_limit(supported);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    auto cc = synthetic_cascade();
+
+    bench_modes(cc);
+    bench_simd(cc);
+    bench_coarse(cc);
+    bench_soft();
+    bench_grouping();
+    bench_tiled(cc);
+    bench_video(cc);
+    bench_motion(cc);
+    bench_masks(cc);
+    bench_anytime(cc);
+    bench_batch(cc);
+    bench_views(cc);
+    bench_bytes(cc);
+    bench_threads(cc);
+    bench_downscale();
+    bench_resize();
+
+    return 0;
+}
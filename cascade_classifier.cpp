@@ -1,26 +1,83 @@
 
 #include "cascade_classifier.h"
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 
 cascade_classifier::cascade_classifier(uint16_t baseResolution) :
 _sc(),
-_baseResolution(baseResolution) {
+_baseResolution(baseResolution),
+_carryScore(false) {
 }
 
 cascade_classifier::~cascade_classifier() noexcept {
 }
 
-bool cascade_classifier::classify(const image<double>& img, uint16_t x, uint16_t y, double mean, double stdev) {
+bool cascade_classifier::classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const {
+    double score = 0.0;
     for (auto& sc : _sc) {
-        if (sc.classify(img, x, y, mean, stdev) == false)
+        if (!_carryScore)
+            score = 0.0;
+        if (sc.classify(img, x, y, mean, stdev, score) == false)
             return false;
     }
 
     return true;
 }
 
-double cascade_classifier::fnr(const std::vector<image<double>>&positiveSet) {
+size_t cascade_classifier::stages_passed(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const {
+    size_t passed = 0;
+    double score = 0.0;
+    for (auto& sc : _sc) {
+        if (!_carryScore)
+            score = 0.0;
+        if (sc.classify(img, x, y, mean, stdev, score) == false)
+            break;
+        ++passed;
+    }
+
+    return passed;
+}
+
+vector<double> cascade_classifier::scores(const vector<image_view<const double>>&set) const {
+    vector<double> result(set.size(), 0.0);
+    if (!_carryScore)
+        return result;
+
+    for (size_t i = 0; i < set.size(); ++i) {
+        for (auto& sc : _sc) {
+            if (sc.classify(set[i], 0, 0, 0.0, 1.0, result[i]) == false)
+                break;
+        }
+    }
+    return result;
+}
+
+void cascade_classifier::calibrate_rejection(const vector<image_view<const double>>&positiveSet) {
+    vector<image_view<const double>> reaching(positiveSet);
+    vector<double> starts(reaching.size(), 0.0);
+
+    for (auto& sc : _sc) {
+        if (!_carryScore)
+            fill(starts.begin(), starts.end(), 0.0);
+        sc.calibrate_rejection(reaching, starts);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < reaching.size(); ++i) {
+            double score = starts[i];
+            if (sc.classify(reaching[i], 0, 0, 0.0, 1.0, score)) {
+                reaching[kept] = reaching[i];
+                starts[kept] = score;
+                ++kept;
+            }
+        }
+        reaching.resize(kept);
+        starts.resize(kept);
+    }
+}
+
+double cascade_classifier::fnr(const std::vector<image_view<const double>>&positiveSet) const {
     size_t fn = 0;
     for (auto& img : positiveSet) {
         if (classify(img, 0, 0, 0.0, 1.0) == false)
@@ -30,7 +87,7 @@ double cascade_classifier::fnr(const std::vector<image<double>>&positiveSet) {
     return ((double) fn) / ((double) positiveSet.size());
 }
 
-double cascade_classifier::fpr(const std::vector<image<double>>&negativeSet) {
+double cascade_classifier::fpr(const std::vector<image_view<const double>>&negativeSet) const {
     size_t fp = 0;
     for (auto& img : negativeSet) {
         if (classify(img, 0, 0, 0.0, 1.0) == true)
@@ -50,3 +107,42 @@ void cascade_classifier::scale(double s) {
     for (auto& sc : _sc)
         sc.scale(s);
 }
+
+cascade_classifier cascade_classifier::scaled(double s) const {
+    cascade_classifier cc((uint16_t) lround(_baseResolution * s));
+    for (auto& sc : _sc)
+        cc.push_back(sc.scaled(s, cc._baseResolution));
+    cc._carryScore = _carryScore;
+    return cc;
+}
+
+cascade_classifier cascade_classifier::transformed(view_transform t) const {
+    cascade_classifier cc(_baseResolution);
+    for (auto& sc : _sc)
+        cc.push_back(sc.transformed(t, _baseResolution));
+    cc._carryScore = _carryScore;
+    return cc;
+}
+
+cascade_scales::cascade_scales(const cascade_classifier& cc, const vector<double>& scales) :
+_scales(scales),
+_cascades() {
+    sort(_scales.begin(), _scales.end());
+    for (auto s : _scales)
+        _cascades.push_back(cc.scaled(s));
+}
+
+cascade_scales::~cascade_scales() noexcept {
+}
+
+size_t cascade_scales::find(double s) const {
+    if (_scales.empty())
+        throw runtime_error("cascade_scales is empty.");
+
+    auto it = lower_bound(_scales.begin(), _scales.end(), s);
+    if (it == _scales.end())
+        return _scales.size() - 1;
+    if (it != _scales.begin() && (s - *(it - 1)) < (*it - s))
+        --it;
+    return it - _scales.begin();
+}
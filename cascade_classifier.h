@@ -6,12 +6,26 @@
 
 using namespace std;
 
+// A cascade is immutable once trained as far as evaluation goes: classify,
+// fnr, fpr, scaled and the get_* accessors are const, keep no state between
+// calls and only read the cascade and the images passed in. Any number of
+// threads (e.g. detectors, see detector.h) can share one const cascade without
+// copies or locks. push_back, pop_back, strictness and scale modify it and
+// must not run concurrently with anything else.
 class cascade_classifier {
 public:
     cascade_classifier(uint16_t baseResolution);
     ~cascade_classifier() noexcept;
 
-    bool classify(const image<double>& img, uint16_t x, uint16_t y, double mean, double stdev);
+    bool classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const;
+
+    // How many stages, from the first, accept the window. classify is true
+    // when this is size().
+    size_t stages_passed(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const;
+
+    size_t size() const {
+        return _sc.size();
+    }
 
     void push_back(const strong_classifier& sc) {
         _sc.push_back(sc);
@@ -20,22 +34,88 @@ public:
     void pop_back() {
         _sc.pop_back();
     };
-    double fnr(const std::vector<image<double>>&positiveSet);
-    double fpr(const std::vector<image<double>>&negativeSet);
+
+    // When set, every stage starts from the running score the stage before
+    // it ended with, rather than from zero, so evidence gathered early keeps
+    // counting (soft cascade). Stage thresholds and rejection traces must
+    // then be computed with the same start scores, see scores(). Off by
+    // default.
+    void set_carry_score(bool carry) {
+        _carryScore = carry;
+    }
+
+    bool carries_score() const {
+        return _carryScore;
+    }
+
+    // Running score each sample (at 0,0 with mean 0 and stdev 1, like fnr)
+    // leaves the cascade with, i.e. the start scores of a stage pushed next.
+    // All zero unless scores are carried.
+    std::vector<double> scores(const std::vector<image_view<const double>>&set) const;
+
+    // Calibrates the rejection traces of every stage (see
+    // strong_classifier::calibrate_rejection) on the positives that reach it.
+    void calibrate_rejection(const std::vector<image_view<const double>>&positiveSet);
+
+    double fnr(const std::vector<image_view<const double>>&positiveSet) const;
+    double fpr(const std::vector<image_view<const double>>&negativeSet) const;
+    // See strong_classifier::strictness, clears the rejection traces.
     void strictness(double p);
 
-    uint16_t get_base_resolution() {
+    uint16_t get_base_resolution() const {
         return _baseResolution;
     }
     void scale(double s);
 
-    std::vector<strong_classifier> get_strong_classifiers() {
+    // Copy of this cascade for windows s times the base resolution. Unlike
+    // scale() this always starts from the unscaled cascade and compensates
+    // for feature rounding (see weak_classifier::scaled).
+    cascade_classifier scaled(double s) const;
+
+    // Virtual view of this cascade for objects turned or flipped by t:
+    // transformed(VIEW_ROTATE_90) accepts in image_rotate_90(img) the windows,
+    // turned the same way, this cascade accepts in img. Only the features are
+    // transformed, the image never is, so any number of views can run on one
+    // integral image (see detector).
+    cascade_classifier transformed(view_transform t) const;
+
+    const std::vector<strong_classifier>& get_strong_classifiers() const {
         return _sc;
     }
 
 private:
     std::vector<strong_classifier> _sc;
     uint16_t _baseResolution;
+    bool _carryScore;
+};
+
+// Immutable set of one cascade pre-scaled to a fixed list of scales, built
+// once and then shared by any number of detectors. Variants are looked up by
+// scale during detection instead of copying and rescaling the cascade. Being
+// immutable it is safe to share between threads.
+class cascade_scales {
+public:
+    cascade_scales(const cascade_classifier& cc, const std::vector<double>& scales);
+    ~cascade_scales() noexcept;
+
+    size_t size() const {
+        return _cascades.size();
+    }
+
+    double scale(size_t i) const {
+        return _scales[i];
+    }
+
+    const cascade_classifier& operator[](size_t i) const {
+        return _cascades[i];
+    }
+
+    // Index of the variant whose scale is closest to s.
+    size_t find(double s) const;
+
+private:
+    std::vector<double> _scales;
+    std::vector<cascade_classifier> _cascades;
 };
 
 #endif
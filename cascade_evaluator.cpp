@@ -0,0 +1,489 @@
+
+#include "cascade_evaluator.h"
+#include "utils.h"
+#include <algorithm>
+#include <limits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+cascade_evaluator::cascade_evaluator() :
+_cc(nullptr),
+_stride(0),
+_carry(false),
+_rects(),
+_weaks(),
+_stages() {
+}
+
+cascade_evaluator::cascade_evaluator(const cascade_classifier& cc, size_t stride) :
+_cc(&cc),
+_stride(stride),
+_carry(cc.carries_score()),
+_rects(),
+_weaks(),
+_stages() {
+    ptrdiff_t s = (ptrdiff_t) stride;
+
+    for (auto& sc : cc.get_strong_classifiers()) {
+        auto& rejection = sc.get_rejection();
+        flat_stage stage{_weaks.size(), 0, sc.get_threshold(), !rejection.empty()};
+
+        auto& wcs = sc.get_weak_classifiers();
+        auto& weights = sc.get_weights();
+        for (size_t i = 0; i < wcs.size(); ++i) {
+            const feature& f = wcs[i].get_feature();
+            flat_weak weak{_rects.size(), 0, 0.0, wcs[i].get_threshold(), 0.0, 0.0,
+                stage.soft ? rejection[i] : -numeric_limits<double>::infinity()};
+
+            feature_rect rects[4];
+            size_t n = feature_rects(f, rects);
+            for (size_t r = 0; r < n; ++r) {
+                ptrdiff_t top = (ptrdiff_t) rects[r].y - 1;
+                ptrdiff_t bottom = (ptrdiff_t) rects[r].y + rects[r].h - 1;
+                ptrdiff_t left = (ptrdiff_t) rects[r].x - 1;
+                ptrdiff_t right = (ptrdiff_t) rects[r].x + rects[r].w - 1;
+                _rects.push_back(flat_rect{top * s + left, top * s + right, bottom * s + left, bottom * s + right, rects[r].sign});
+            }
+            weak.rectEnd = _rects.size();
+
+            // same compensation as weak_classifier::classify
+            if (f.type == C)
+                weak.meanWeight = (f.width / 3) * f.height;
+            else if (f.type == CT)
+                weak.meanWeight = f.width * (f.height / 3);
+
+            weak.below = weights[i] * (wcs[i].get_polarity() ? 1 : -1);
+            weak.above = weights[i] * (wcs[i].get_polarity() ? -1 : 1);
+            _weaks.push_back(weak);
+        }
+
+        stage.weakEnd = _weaks.size();
+        _stages.push_back(stage);
+    }
+}
+
+cascade_evaluator::~cascade_evaluator() noexcept {
+}
+
+void cascade_evaluator::_classify_scalar(const image_view<const double>& ii, uint16_t x, uint16_t y, uint16_t step, size_t count,
+        const double* mean, const double* stdev, uint8_t* accepted, uint16_t* passed) const {
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t wx = (uint16_t) (x + i * step);
+        if (passed)
+            passed[i] = (uint16_t) _cc->stages_passed(ii, wx, y, mean[i], stdev[i]);
+        else accepted[i] = _cc->classify(ii, wx, y, mean[i], stdev[i]) ? 1 : 0;
+    }
+}
+
+// Copy of count <= BLOCK windows, padded to BLOCK by repeating the last one so
+// the kernels always work on full vectors.
+template<size_t BLOCK>
+struct _window_block {
+    int64_t offsets[BLOCK];
+    double means[BLOCK];
+    double stdevs[BLOCK];
+    uint32_t ids[BLOCK];
+    double scores[BLOCK];
+    size_t lanes;
+
+    void fill(const int64_t* o, const double* m, const double* sd, const uint32_t* id, const double* score, size_t count) {
+        lanes = count;
+        for (size_t l = 0; l < BLOCK; ++l) {
+            size_t k = min(l, lanes - 1);
+            offsets[l] = o[k];
+            means[l] = m[k];
+            stdevs[l] = sd[k];
+            ids[l] = id ? id[k] : 0;
+            scores[l] = score ? score[k] : 0.0;
+        }
+    }
+};
+
+void cascade_evaluator::classify(const image_view<const double>& ii,
+        uint16_t x,
+        uint16_t y,
+        uint16_t step,
+        size_t count,
+        const double* mean,
+        const double* stdev,
+        uint8_t* accepted) const {
+    _classify_row(ii, x, y, step, count, mean, stdev, accepted, nullptr);
+}
+
+void cascade_evaluator::stages_passed(const image_view<const double>& ii,
+        uint16_t x,
+        uint16_t y,
+        uint16_t step,
+        size_t count,
+        const double* mean,
+        const double* stdev,
+        uint16_t* passed) const {
+    _classify_row(ii, x, y, step, count, mean, stdev, nullptr, passed);
+}
+
+// Fills either accepted or passed.
+void cascade_evaluator::_classify_row(const image_view<const double>& ii, uint16_t x, uint16_t y, uint16_t step, size_t count,
+        const double* mean, const double* stdev, uint8_t* accepted, uint16_t* passed) const {
+    if (ii.stride != _stride)
+        throw runtime_error("cascade_evaluator built for a different integral stride.");
+
+    simd_level simd = simd_supported();
+
+    // corners of windows on the top row or left column fall outside the
+    // integral, the cascade's own classify handles those
+    if (simd < SIMD_AVX2 || y == 0) {
+        _classify_scalar(ii, x, y, step, count, mean, stdev, accepted, passed);
+        return;
+    }
+    if (x == 0 && count > 0) {
+        _classify_scalar(ii, x, y, step, 1, mean, stdev, accepted, passed);
+        x += step;
+        ++mean;
+        ++stdev;
+        accepted = accepted ? accepted + 1 : nullptr;
+        passed = passed ? passed + 1 : nullptr;
+        --count;
+    }
+
+    size_t blockSize = (simd >= SIMD_AVX512) ? 16 : 8;
+    int64_t offsets[16];
+    uint16_t depth[16];
+    _window_block<16> block;
+
+    for (size_t i = 0; i < count; i += blockSize) {
+        size_t lanes = min(blockSize, count - i);
+        for (size_t l = 0; l < lanes; ++l)
+            offsets[l] = (int64_t) (y * ii.stride) + x + (int64_t) (i + l) * step;
+        block.fill(offsets, mean + i, stdev + i, nullptr, nullptr, lanes);
+
+        // adjacent windows of a full block are plain loads rather than gathers
+        bool contiguous = (step == 1 && lanes == blockSize);
+        unsigned pass = 0;
+        uint16_t* blockDepth = passed ? depth : nullptr;
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd >= SIMD_AVX512)
+            pass = _block_avx512(ii.bits, block.offsets, contiguous, block.means, block.stdevs, block.scores, 0, _stages.size(), blockDepth);
+        else pass = _block_avx2(ii.bits, block.offsets, contiguous, block.means, block.stdevs, block.scores, 0, _stages.size(), blockDepth);
+#endif
+        for (size_t l = 0; l < lanes; ++l) {
+            if (passed)
+                passed[i + l] = depth[l];
+            else accepted[i + l] = (pass >> l) & 1;
+        }
+    }
+}
+
+// One stage over the first count survivors, the ones it accepts are moved to
+// the front (in order). Returns how many that is.
+size_t cascade_evaluator::_stage_scalar(const flat_stage& stage, const double* bits, cascade_survivors& survivors, size_t count) const {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const double* origin = bits + survivors.offsets[i];
+        double mean = survivors.means[i];
+        double stdev = survivors.stdevs[i];
+        double score = _carry ? survivors.scores[i] : 0.0;
+        bool rejected = false;
+
+        for (size_t w = stage.weakBegin; w < stage.weakEnd; ++w) {
+            const flat_weak& weak = _weaks[w];
+            double value = 0.0;
+            for (size_t r = weak.rectBegin; r < weak.rectEnd; ++r) {
+                const flat_rect& rect = _rects[r];
+                double v = origin[rect.br];
+                v -= origin[rect.bl];
+                v -= origin[rect.tr];
+                v += origin[rect.tl];
+                if (r == weak.rectBegin)
+                    value = v;
+                else if (rect.sign > 0)
+                    value += v;
+                else value -= v;
+            }
+            if (weak.meanWeight != 0.0)
+                value += weak.meanWeight * mean;
+            if (stdev != 0.0)
+                value /= stdev;
+            score += (value < weak.threshold) ? weak.below : weak.above;
+            if (stage.soft && score < weak.rejection) {
+                rejected = true;
+                break;
+            }
+        }
+
+        if (!rejected && score >= stage.threshold) {
+            survivors.offsets[kept] = survivors.offsets[i];
+            survivors.means[kept] = mean;
+            survivors.stdevs[kept] = stdev;
+            survivors.ids[kept] = survivors.ids[i];
+            survivors.scores[kept] = score;
+            ++kept;
+        }
+    }
+    return kept;
+}
+
+size_t cascade_evaluator::_stage_simd(size_t stageIndex, bool avx512, const double* bits, cascade_survivors& survivors, size_t count) const {
+    size_t blockSize = avx512 ? 16 : 8;
+    size_t kept = 0;
+    _window_block<16> block;
+
+    for (size_t i = 0; i < count; i += blockSize) {
+        // the block is copied out before any survivor is written back, so
+        // compacting in place is safe
+        block.fill(survivors.offsets.data() + i, survivors.means.data() + i, survivors.stdevs.data() + i,
+                survivors.ids.data() + i, survivors.scores.data() + i, min(blockSize, count - i));
+
+        // early stages see runs of adjacent windows, those need no gathers
+        bool contiguous = (block.lanes == blockSize);
+        for (size_t l = 1; contiguous && l < blockSize; ++l)
+            contiguous = (block.offsets[l] == block.offsets[0] + (int64_t) l);
+
+        unsigned pass = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        if (avx512)
+            pass = _block_avx512(bits, block.offsets, contiguous, block.means, block.stdevs, block.scores, stageIndex, stageIndex + 1, nullptr);
+        else pass = _block_avx2(bits, block.offsets, contiguous, block.means, block.stdevs, block.scores, stageIndex, stageIndex + 1, nullptr);
+#endif
+        for (size_t l = 0; l < block.lanes; ++l) {
+            if ((pass >> l) & 1) {
+                survivors.offsets[kept] = block.offsets[l];
+                survivors.means[kept] = block.means[l];
+                survivors.stdevs[kept] = block.stdevs[l];
+                survivors.ids[kept] = block.ids[l];
+                survivors.scores[kept] = block.scores[l];
+                ++kept;
+            }
+        }
+    }
+    return kept;
+}
+
+void cascade_evaluator::classify_survivors(const image_view<const double>& ii, cascade_survivors& survivors) const {
+    if (ii.stride != _stride)
+        throw runtime_error("cascade_evaluator built for a different integral stride.");
+
+    simd_level simd = simd_supported();
+    size_t count = survivors.size();
+
+    for (size_t s = 0; s < _stages.size() && count > 0; ++s) {
+        if (simd >= SIMD_AVX2)
+            count = _stage_simd(s, simd >= SIMD_AVX512, ii.bits, survivors, count);
+        else count = _stage_scalar(_stages[s], ii.bits, survivors, count);
+    }
+
+    survivors.resize(count);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Corner values of 8 (AVX2) or 16 (AVX-512) windows: consecutive doubles
+// from p + offsets[0], or gathered from p + offsets[l].
+__attribute__((target("avx2")))
+static inline void _load_avx2(const double* p, const int64_t* offsets, bool contiguous, __m256i idxA, __m256i idxB, __m256d& a, __m256d& b) {
+    if (contiguous) {
+        a = _mm256_loadu_pd(p + offsets[0]);
+        b = _mm256_loadu_pd(p + offsets[0] + 4);
+    } else {
+        a = _mm256_i64gather_pd(p, idxA, 8);
+        b = _mm256_i64gather_pd(p, idxB, 8);
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline void _load_avx512(const double* p, const int64_t* offsets, bool contiguous, __m512i idxA, __m512i idxB, __m512d& a, __m512d& b) {
+    if (contiguous) {
+        a = _mm512_loadu_pd(p + offsets[0]);
+        b = _mm512_loadu_pd(p + offsets[0] + 8);
+    } else {
+        // all lanes, masked so the gather's source is a defined zero
+        const __m512d zero = _mm512_setzero_pd();
+        a = _mm512_mask_i64gather_pd(zero, (__mmask8) 0xFF, idxA, p, 8);
+        b = _mm512_mask_i64gather_pd(zero, (__mmask8) 0xFF, idxB, p, 8);
+    }
+}
+
+// Stages [firstStage, lastStage) over 8 windows as two vectors of 4 (lanes
+// 0-3 and 4-7). Returns the lanes that passed every stage, it stops early
+// once no lane is left. passed, when given, receives the number of stages
+// each lane got through. score holds each lane's carried score going in and
+// coming out, it is only read when the cascade carries scores.
+__attribute__((target("avx2")))
+unsigned cascade_evaluator::_block_avx2(const double* bits, const int64_t* offsets, bool contiguous,
+        const double* mean, const double* stdev, double* score, size_t firstStage, size_t lastStage, uint16_t* passed) const {
+    if (passed)
+        fill(passed, passed + 8, 0);
+
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256i idxA = _mm256_loadu_si256((const __m256i*) offsets);
+    const __m256i idxB = _mm256_loadu_si256((const __m256i*) (offsets + 4));
+    const __m256d meanA = _mm256_loadu_pd(mean), meanB = _mm256_loadu_pd(mean + 4);
+    const __m256d sdA = _mm256_loadu_pd(stdev), sdB = _mm256_loadu_pd(stdev + 4);
+    const __m256d sdZeroA = _mm256_cmp_pd(sdA, zero, _CMP_EQ_OQ);
+    const __m256d sdZeroB = _mm256_cmp_pd(sdB, zero, _CMP_EQ_OQ);
+
+    __m256d aliveA = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    __m256d aliveB = aliveA;
+    __m256d carryA = _mm256_loadu_pd(score), carryB = _mm256_loadu_pd(score + 4);
+
+    for (size_t s = firstStage; s < lastStage; ++s) {
+        const flat_stage& stage = _stages[s];
+        __m256d scoreA = _carry ? carryA : zero, scoreB = _carry ? carryB : zero;
+
+        for (size_t w = stage.weakBegin; w < stage.weakEnd; ++w) {
+            const flat_weak& weak = _weaks[w];
+            __m256d valueA = zero, valueB = zero;
+
+            for (size_t r = weak.rectBegin; r < weak.rectEnd; ++r) {
+                const flat_rect& rect = _rects[r];
+                __m256d brA, brB, blA, blB, trA, trB, tlA, tlB;
+                _load_avx2(bits + rect.br, offsets, contiguous, idxA, idxB, brA, brB);
+                _load_avx2(bits + rect.bl, offsets, contiguous, idxA, idxB, blA, blB);
+                _load_avx2(bits + rect.tr, offsets, contiguous, idxA, idxB, trA, trB);
+                _load_avx2(bits + rect.tl, offsets, contiguous, idxA, idxB, tlA, tlB);
+                __m256d rectA = _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(brA, blA), trA), tlA);
+                __m256d rectB = _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(brB, blB), trB), tlB);
+
+                if (r == weak.rectBegin) {
+                    valueA = rectA;
+                    valueB = rectB;
+                } else if (rect.sign > 0) {
+                    valueA = _mm256_add_pd(valueA, rectA);
+                    valueB = _mm256_add_pd(valueB, rectB);
+                } else {
+                    valueA = _mm256_sub_pd(valueA, rectA);
+                    valueB = _mm256_sub_pd(valueB, rectB);
+                }
+            }
+
+            if (weak.meanWeight != 0.0) {
+                __m256d meanWeight = _mm256_set1_pd(weak.meanWeight);
+                valueA = _mm256_add_pd(valueA, _mm256_mul_pd(meanWeight, meanA));
+                valueB = _mm256_add_pd(valueB, _mm256_mul_pd(meanWeight, meanB));
+            }
+            valueA = _mm256_blendv_pd(_mm256_div_pd(valueA, sdA), valueA, sdZeroA);
+            valueB = _mm256_blendv_pd(_mm256_div_pd(valueB, sdB), valueB, sdZeroB);
+
+            __m256d threshold = _mm256_set1_pd(weak.threshold);
+            __m256d below = _mm256_set1_pd(weak.below), above = _mm256_set1_pd(weak.above);
+            scoreA = _mm256_add_pd(scoreA, _mm256_blendv_pd(above, below, _mm256_cmp_pd(valueA, threshold, _CMP_LT_OQ)));
+            scoreB = _mm256_add_pd(scoreB, _mm256_blendv_pd(above, below, _mm256_cmp_pd(valueB, threshold, _CMP_LT_OQ)));
+
+            if (stage.soft) {
+                __m256d rejection = _mm256_set1_pd(weak.rejection);
+                aliveA = _mm256_and_pd(aliveA, _mm256_cmp_pd(scoreA, rejection, _CMP_GE_OQ));
+                aliveB = _mm256_and_pd(aliveB, _mm256_cmp_pd(scoreB, rejection, _CMP_GE_OQ));
+                if ((_mm256_movemask_pd(aliveA) | _mm256_movemask_pd(aliveB)) == 0)
+                    break;
+            }
+        }
+        carryA = scoreA;
+        carryB = scoreB;
+
+        __m256d threshold = _mm256_set1_pd(stage.threshold);
+        aliveA = _mm256_and_pd(aliveA, _mm256_cmp_pd(scoreA, threshold, _CMP_GE_OQ));
+        aliveB = _mm256_and_pd(aliveB, _mm256_cmp_pd(scoreB, threshold, _CMP_GE_OQ));
+        int alive = _mm256_movemask_pd(aliveA) | (_mm256_movemask_pd(aliveB) << 4);
+        if (passed)
+            for (int l = 0; l < 8; ++l)
+                passed[l] += (alive >> l) & 1;
+        if (alive == 0)
+            break;
+    }
+
+    _mm256_storeu_pd(score, carryA);
+    _mm256_storeu_pd(score + 4, carryB);
+    return (unsigned) (_mm256_movemask_pd(aliveA) | (_mm256_movemask_pd(aliveB) << 4));
+}
+
+// Same as _block_avx2 for 16 windows in two vectors of 8, with real lane masks.
+__attribute__((target("avx512f")))
+unsigned cascade_evaluator::_block_avx512(const double* bits, const int64_t* offsets, bool contiguous,
+        const double* mean, const double* stdev, double* score, size_t firstStage, size_t lastStage, uint16_t* passed) const {
+    if (passed)
+        fill(passed, passed + 16, 0);
+
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512i idxA = _mm512_loadu_si512(offsets);
+    const __m512i idxB = _mm512_loadu_si512(offsets + 8);
+    const __m512d meanA = _mm512_loadu_pd(mean), meanB = _mm512_loadu_pd(mean + 8);
+    const __m512d sdA = _mm512_loadu_pd(stdev), sdB = _mm512_loadu_pd(stdev + 8);
+    const __mmask8 sdSetA = _mm512_cmp_pd_mask(sdA, zero, _CMP_NEQ_UQ);
+    const __mmask8 sdSetB = _mm512_cmp_pd_mask(sdB, zero, _CMP_NEQ_UQ);
+
+    __mmask8 aliveA = 0xff, aliveB = 0xff;
+    __m512d carryA = _mm512_loadu_pd(score), carryB = _mm512_loadu_pd(score + 8);
+
+    for (size_t s = firstStage; s < lastStage; ++s) {
+        const flat_stage& stage = _stages[s];
+        __m512d scoreA = _carry ? carryA : zero, scoreB = _carry ? carryB : zero;
+
+        for (size_t w = stage.weakBegin; w < stage.weakEnd; ++w) {
+            const flat_weak& weak = _weaks[w];
+            __m512d valueA = zero, valueB = zero;
+
+            for (size_t r = weak.rectBegin; r < weak.rectEnd; ++r) {
+                const flat_rect& rect = _rects[r];
+                __m512d brA, brB, blA, blB, trA, trB, tlA, tlB;
+                _load_avx512(bits + rect.br, offsets, contiguous, idxA, idxB, brA, brB);
+                _load_avx512(bits + rect.bl, offsets, contiguous, idxA, idxB, blA, blB);
+                _load_avx512(bits + rect.tr, offsets, contiguous, idxA, idxB, trA, trB);
+                _load_avx512(bits + rect.tl, offsets, contiguous, idxA, idxB, tlA, tlB);
+                __m512d rectA = _mm512_add_pd(_mm512_sub_pd(_mm512_sub_pd(brA, blA), trA), tlA);
+                __m512d rectB = _mm512_add_pd(_mm512_sub_pd(_mm512_sub_pd(brB, blB), trB), tlB);
+
+                if (r == weak.rectBegin) {
+                    valueA = rectA;
+                    valueB = rectB;
+                } else if (rect.sign > 0) {
+                    valueA = _mm512_add_pd(valueA, rectA);
+                    valueB = _mm512_add_pd(valueB, rectB);
+                } else {
+                    valueA = _mm512_sub_pd(valueA, rectA);
+                    valueB = _mm512_sub_pd(valueB, rectB);
+                }
+            }
+
+            if (weak.meanWeight != 0.0) {
+                __m512d meanWeight = _mm512_set1_pd(weak.meanWeight);
+                valueA = _mm512_add_pd(valueA, _mm512_mul_pd(meanWeight, meanA));
+                valueB = _mm512_add_pd(valueB, _mm512_mul_pd(meanWeight, meanB));
+            }
+            valueA = _mm512_mask_div_pd(valueA, sdSetA, valueA, sdA);
+            valueB = _mm512_mask_div_pd(valueB, sdSetB, valueB, sdB);
+
+            __m512d threshold = _mm512_set1_pd(weak.threshold);
+            __m512d below = _mm512_set1_pd(weak.below), above = _mm512_set1_pd(weak.above);
+            scoreA = _mm512_add_pd(scoreA, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(valueA, threshold, _CMP_LT_OQ), above, below));
+            scoreB = _mm512_add_pd(scoreB, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(valueB, threshold, _CMP_LT_OQ), above, below));
+
+            if (stage.soft) {
+                __m512d rejection = _mm512_set1_pd(weak.rejection);
+                aliveA = _mm512_mask_cmp_pd_mask(aliveA, scoreA, rejection, _CMP_GE_OQ);
+                aliveB = _mm512_mask_cmp_pd_mask(aliveB, scoreB, rejection, _CMP_GE_OQ);
+                if ((aliveA | aliveB) == 0)
+                    break;
+            }
+        }
+        carryA = scoreA;
+        carryB = scoreB;
+
+        __m512d threshold = _mm512_set1_pd(stage.threshold);
+        aliveA = _mm512_mask_cmp_pd_mask(aliveA, scoreA, threshold, _CMP_GE_OQ);
+        aliveB = _mm512_mask_cmp_pd_mask(aliveB, scoreB, threshold, _CMP_GE_OQ);
+        unsigned alive = aliveA | ((unsigned) aliveB << 8);
+        if (passed)
+            for (int l = 0; l < 16; ++l)
+                passed[l] += (alive >> l) & 1;
+        if (alive == 0)
+            break;
+    }
+
+    _mm512_storeu_pd(score, carryA);
+    _mm512_storeu_pd(score + 8, carryB);
+    return aliveA | ((unsigned) aliveB << 8);
+}
+
+#endif
@@ -0,0 +1,168 @@
+
+#ifndef __cascade_evaluator_h
+#define __cascade_evaluator_h
+
+#include "cascade_classifier.h"
+#include <vector>
+
+// Windows for cascade_evaluator::classify_survivors, as parallel arrays: the
+// offset of each window's origin in the integral's bits, its normalization,
+// an id for the caller and the running score carried between stages (see
+// cascade_classifier::set_carry_score). Keep one per thread and reserve it up
+// front, the evaluation itself then does not allocate.
+struct cascade_survivors {
+    std::vector<int64_t> offsets;
+    std::vector<double> means;
+    std::vector<double> stdevs;
+    std::vector<uint32_t> ids;
+    std::vector<double> scores;
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+    void clear() {
+        offsets.clear();
+        means.clear();
+        stdevs.clear();
+        ids.clear();
+        scores.clear();
+    }
+
+    void reserve(size_t n) {
+        offsets.reserve(n);
+        means.reserve(n);
+        stdevs.reserve(n);
+        ids.reserve(n);
+        scores.reserve(n);
+    }
+
+    void push_back(int64_t offset, double mean, double stdev, uint32_t id) {
+        offsets.push_back(offset);
+        means.push_back(mean);
+        stdevs.push_back(stdev);
+        ids.push_back(id);
+        scores.push_back(0.0);
+    }
+
+    void resize(size_t n) {
+        offsets.resize(n);
+        means.resize(n);
+        stdevs.resize(n);
+        ids.resize(n);
+        scores.resize(n);
+    }
+};
+
+// A cascade flattened for one integral image layout: every rectangle of every
+// feature becomes four corner offsets from the window origin, precomputed for
+// the integral's stride. This lets classify() run a whole stage over 8 (AVX2)
+// or 16 (AVX-512) horizontally adjacent windows at once. Windows a stage
+// rejects are masked off and a block stops as soon as every window in it is
+// rejected. Rejection traces (soft cascades) mask windows off after the weak
+// classifier that rejects them, and carried scores carry over between stages.
+// The kernel is picked at runtime (see simd_supported()); without
+// SIMD, and for windows touching the top or left edge of the image, the
+// cascade's own classify is used. Every path gives the same answers as
+// cascade_classifier::classify.
+//
+// The evaluator keeps a pointer to the cascade, which has to outlive it. It
+// is immutable once built and can be shared between threads.
+class cascade_evaluator {
+public:
+    cascade_evaluator();
+    cascade_evaluator(const cascade_classifier& cc, size_t stride);
+    ~cascade_evaluator() noexcept;
+
+    // Classify count windows at (x + i * step, y), i < count, of ii (whose
+    // stride must be the one the evaluator was built for). mean and stdev hold
+    // the normalization of every window, accepted[i] is set to 1 or 0.
+    void classify(const image_view<const double>& ii,
+            uint16_t x,
+            uint16_t y,
+            uint16_t step,
+            size_t count,
+            const double* mean,
+            const double* stdev,
+            uint8_t* accepted) const;
+
+    // Like classify, but passed[i] is the number of stages window i passed
+    // (stages() if the cascade accepts it).
+    void stages_passed(const image_view<const double>& ii,
+            uint16_t x,
+            uint16_t y,
+            uint16_t step,
+            size_t count,
+            const double* mean,
+            const double* stdev,
+            uint16_t* passed) const;
+
+    size_t stages() const {
+        return _stages.size();
+    }
+
+    // Breadth first evaluation of an arbitrary list of windows: stage k runs
+    // over every window that passed stage k - 1, and the rejected ones are
+    // compacted away (keeping their order) before stage k + 1, so the stage
+    // being evaluated stays in cache and the SIMD lanes stay full. On return
+    // survivors holds the windows the whole cascade accepted. Window origins
+    // must not be on the top row or left column of ii.
+    void classify_survivors(const image_view<const double>& ii, cascade_survivors& survivors) const;
+
+    size_t stride() const {
+        return _stride;
+    }
+
+private:
+    // Corners of one rectangle relative to the window origin, its value is
+    // br - bl - tr + tl.
+    struct flat_rect {
+        ptrdiff_t tl;
+        ptrdiff_t tr;
+        ptrdiff_t bl;
+        ptrdiff_t br;
+        int sign;
+    };
+
+    struct flat_weak {
+        size_t rectBegin;
+        size_t rectEnd;
+        double meanWeight;
+        double threshold;
+        // what the weak classifier adds to the stage score when its value is
+        // below the threshold, and when it is not
+        double below;
+        double above;
+        // rejection trace on the running score after this weak classifier
+        double rejection;
+    };
+
+    struct flat_stage {
+        size_t weakBegin;
+        size_t weakEnd;
+        double threshold;
+        // whether the weaks have rejection traces
+        bool soft;
+    };
+
+    void _classify_row(const image_view<const double>& ii, uint16_t x, uint16_t y, uint16_t step, size_t count,
+            const double* mean, const double* stdev, uint8_t* accepted, uint16_t* passed) const;
+    void _classify_scalar(const image_view<const double>& ii, uint16_t x, uint16_t y, uint16_t step, size_t count,
+            const double* mean, const double* stdev, uint8_t* accepted, uint16_t* passed) const;
+    unsigned _block_avx2(const double* bits, const int64_t* offsets, bool contiguous,
+            const double* mean, const double* stdev, double* score, size_t firstStage, size_t lastStage, uint16_t* passed) const;
+    unsigned _block_avx512(const double* bits, const int64_t* offsets, bool contiguous,
+            const double* mean, const double* stdev, double* score, size_t firstStage, size_t lastStage, uint16_t* passed) const;
+
+    size_t _stage_scalar(const flat_stage& stage, const double* bits, cascade_survivors& survivors, size_t count) const;
+    size_t _stage_simd(size_t stage, bool avx512, const double* bits, cascade_survivors& survivors, size_t count) const;
+
+    const cascade_classifier* _cc;
+    size_t _stride;
+    bool _carry;
+    std::vector<flat_rect> _rects;
+    std::vector<flat_weak> _weaks;
+    std::vector<flat_stage> _stages;
+};
+
+#endif
@@ -0,0 +1,115 @@
+
+#include "detection_mask.h"
+
+using namespace std;
+
+detection_mask::detection_mask(uint16_t cell, double minFraction) :
+_cell(cell),
+_mask(),
+_integral(),
+_gate(),
+_x0(0),
+_y0(0),
+_x1(-1),
+_y1(-1),
+_allocations(0) {
+    if (cell == 0)
+        throw runtime_error("detection_mask cell must be at least 1.");
+    _gate.cell = cell;
+    _gate.minFraction = minFraction;
+}
+
+detection_mask::~detection_mask() noexcept {
+}
+
+// Clear the block mask for a w x h pixel frame starting at (x, y).
+void detection_mask::_resize(uint16_t w, uint16_t h, uint32_t x, uint32_t y) {
+    uint16_t bw = (uint16_t) ((w + _cell - 1) / _cell);
+    uint16_t bh = (uint16_t) ((h + _cell - 1) / _cell);
+    if (_mask.w != bw || _mask.h != bh) {
+        _mask = image_create_padded<double>(bw, bh);
+        _integral = image_create_padded<double>(bw, bh);
+        _allocations += 2;
+    }
+
+    image_view<double> mask(_mask);
+    for (uint16_t by = 0; by < bh; ++by)
+        fill(mask.row(by), mask.row(by) + bw, 0.0);
+    _gate.x = x;
+    _gate.y = y;
+}
+
+// Integrate the block mask and find the bounding region of its set blocks.
+void detection_mask::_finish() {
+    image_integral(image_view<const double>(_mask), image_view<double>(_integral));
+    _gate.mask = _integral;
+
+    _x0 = _y0 = INT64_MAX;
+    _x1 = _y1 = -1;
+    image_view<const double> mask(_mask);
+    for (uint16_t by = 0; by < mask.h; ++by) {
+        const double* row = mask.row(by);
+        for (uint16_t bx = 0; bx < mask.w; ++bx) {
+            if (row[bx] != 0.0) {
+                _x0 = min(_x0, (int64_t) bx);
+                _x1 = max(_x1, (int64_t) bx);
+                _y0 = min(_y0, (int64_t) by);
+                _y1 = max(_y1, (int64_t) by);
+            }
+        }
+    }
+}
+
+void detection_mask::set_rois(uint16_t w, uint16_t h, const vector<detection>& rois) {
+    _resize(w, h, 0, 0);
+
+    image_view<double> mask(_mask);
+    for (auto& r : rois) {
+        uint32_t x1 = min((uint32_t) w, r.x + r.w), y1 = min((uint32_t) h, r.y + r.h);
+        if (r.x >= x1 || r.y >= y1)
+            continue;
+        for (uint32_t by = r.y / _cell; by <= (y1 - 1) / _cell; ++by)
+            fill(mask.row((uint16_t) by) + r.x / _cell, mask.row((uint16_t) by) + (x1 - 1) / _cell + 1, 1.0);
+    }
+    _finish();
+}
+
+void detection_mask::set_mask(const image_view<const uint8_t>& mask) {
+    _resize(mask.w, mask.h, mask.x, mask.y);
+
+    image_view<double> blocks(_mask);
+    for (uint16_t y = 0; y < mask.h; ++y) {
+        const uint8_t* row = mask.row(y);
+        double* out = blocks.row(y / _cell);
+        for (uint16_t x = 0; x < mask.w; ++x)
+            if (row[x])
+                out[x / _cell] = 1.0;
+    }
+    _finish();
+}
+
+bool detection_mask::bounds(uint32_t& x, uint32_t& y, uint32_t& w, uint32_t& h) const {
+    if (_x0 > _x1)
+        return false;
+    x = _gate.x + (uint32_t) _x0 * _cell;
+    y = _gate.y + (uint32_t) _y0 * _cell;
+    w = (uint32_t) (_x1 - _x0 + 1) * _cell;
+    h = (uint32_t) (_y1 - _y0 + 1) * _cell;
+    return true;
+}
+
+const vector<detection>& detect_masked(detector& d, const image_view<const double>& lum, const detection_mask& mask) {
+    static const vector<detection> none;
+
+    // the bounding region of the mask, within lum
+    uint32_t x, y, w, h;
+    if (!mask.bounds(x, y, w, h))
+        return none;
+    uint32_t x0 = max(x, (uint32_t) lum.x), x1 = min(x + w, (uint32_t) lum.x + lum.w);
+    uint32_t y0 = max(y, (uint32_t) lum.y), y1 = min(y + h, (uint32_t) lum.y + lum.h);
+    if (x0 >= x1 || y0 >= y1)
+        return none;
+
+    auto region = image_roi(lum, (uint16_t) (x0 - lum.x), (uint16_t) (y0 - lum.y), (uint16_t) (x1 - x0), (uint16_t) (y1 - y0));
+    return d.detect(region, mask.gate());
+}
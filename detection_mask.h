@@ -0,0 +1,65 @@
+
+#ifndef __detection_mask_h
+#define __detection_mask_h
+
+#include "detector.h"
+
+// Part of the frame detection is restricted to, given as a list of regions of
+// interest or a binary mask. Either is converted once into the integral of a
+// mask of cell x cell pixel blocks, a block being set when any of its pixels
+// is in the mask, and the bounding region of the set blocks.
+// detect_masked() scans only that bounding region of the frame (integrals and
+// pyramid included) and, through a window_gate, only the windows of which at
+// least minFraction of the blocks are set. With the default minFraction of 1
+// every window reported lies inside the mask (up to the block size).
+//
+// A mask is meant to be built once and used for many frames. The buffers are
+// sized on first use, allocations() counts every time they had to be
+// (re)allocated. The detector re-sizes its own buffers when the bounding
+// region changes size.
+class detection_mask {
+public:
+    detection_mask(uint16_t cell = 4, double minFraction = 1.0);
+    ~detection_mask() noexcept;
+
+    // Regions of interest, in the coordinates of a w x h frame.
+    void set_rois(uint16_t w, uint16_t h, const std::vector<detection>& rois);
+
+    // Pixels that are not 0 are in the mask. mask covers the frame from
+    // (mask.x, mask.y) on, so a view of a larger mask image works as well.
+    void set_mask(const image_view<const uint8_t>& mask);
+
+    const window_gate& gate() const {
+        return _gate;
+    }
+
+    // Bounding region of the set blocks in frame coordinates, false when
+    // nothing is set.
+    bool bounds(uint32_t& x, uint32_t& y, uint32_t& w, uint32_t& h) const;
+
+    size_t allocations() const {
+        return _allocations;
+    }
+
+private:
+    void _resize(uint16_t w, uint16_t h, uint32_t x, uint32_t y);
+    void _finish();
+
+    uint16_t _cell;
+    image<double> _mask;
+    image<double> _integral;
+    window_gate _gate;
+    // set blocks span [_x0, _x1] x [_y0, _y1], empty when _x0 > _x1
+    int64_t _x0;
+    int64_t _y0;
+    int64_t _x1;
+    int64_t _y1;
+    size_t _allocations;
+};
+
+// Detect with d on the part of lum that mask leaves, see detection_mask.
+// Detections are in frame coordinates, as for detector::detect. The result
+// stays valid until the next call on d.
+const std::vector<detection>& detect_masked(detector& d, const image_view<const double>& lum, const detection_mask& mask);
+
+#endif
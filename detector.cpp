@@ -0,0 +1,1007 @@
+#include "detector.h"
+#include <cmath>
+#include <chrono>
+
+using namespace std;
+
+// Windows per breadth first chunk: long enough survivor lists to keep the
+// vector lanes full through the later stages, small enough to stay in cache.
+static const size_t BREADTH_FIRST_WINDOWS = 16384;
+
+// Rows of windows handled at once by the breadth first and coarse to fine
+// scans. Coarse to fine chunks hold whole coarse rows.
+static size_t _chunk_rows(size_t cols, size_t coarseStep) {
+    return max(coarseStep, (BREADTH_FIRST_WINDOWS / cols) / coarseStep * coarseStep);
+}
+
+// Scale of the image a window of scale s is scanned on in each mode.
+static double _source_scale(detect_mode mode, double s) {
+    if (mode == DETECT_PYRAMID)
+        return s;
+    if (mode == DETECT_HYBRID)
+        return pow(2.0, floor(log2(s) + 1e-9));
+    return 1.0;
+}
+
+vector<double> detect_cascade_scales(const detect_params& params, uint16_t baseResolution) {
+    if (params.scaleFactor <= 1.0)
+        throw runtime_error("detector scaleFactor must be greater than 1.");
+
+    vector<double> scales;
+    for (double s = 1.0; baseResolution * s <= UINT16_MAX; s *= params.scaleFactor) {
+        double featureScale = s / _source_scale(params.mode, s);
+        bool present = false;
+        for (auto existing : scales)
+            present = present || fabs(existing - featureScale) < 1e-9;
+        if (!present)
+            scales.push_back(featureScale);
+    }
+    return scales;
+}
+
+// Scaled variants of every cascade, for params.
+static vector<shared_ptr<const cascade_scales>> _variants(const vector<cascade_classifier>& cascades, const detect_params& params) {
+    vector<shared_ptr<const cascade_scales>> variants;
+    for (auto& cc : cascades)
+        variants.push_back(make_shared<const cascade_scales>(cc, detect_cascade_scales(params, cc.get_base_resolution())));
+    return variants;
+}
+
+detector::detector(const cascade_classifier& cc, const detect_params& params) :
+detector(std::make_shared<const cascade_scales>(cc, detect_cascade_scales(params, cc.get_base_resolution())), params) {
+}
+
+detector::detector(std::shared_ptr<const cascade_scales> cascades, const detect_params& params) :
+detector(vector<shared_ptr<const cascade_scales>>{cascades}, params) {
+}
+
+detector::detector(const vector<cascade_classifier>& cascades, const detect_params& params) :
+detector(_variants(cascades, params), params) {
+}
+
+detector::detector(const vector<shared_ptr<const cascade_scales>>& cascades, const detect_params& params) :
+_cascades(cascades),
+_params(params),
+_baseResolution(0),
+_w(0),
+_h(0),
+_sources(),
+_levels(),
+_frames(),
+_tasks(),
+_jobs(),
+_order(),
+_scheduled(0),
+_workers(),
+_detections(),
+_batchDetections(),
+_gate(nullptr),
+_levelOrder(),
+_anytimeRows(),
+_anytimeNext(0),
+_anytimeScanned(0),
+_anytimeTotal(0),
+_threads(),
+_poolMutex(),
+_poolStart(),
+_poolDone(),
+_generation(0),
+_pending(0),
+_poolError(),
+_stopping(false),
+_integrating(false),
+_batch(0),
+_nextFrame(0),
+_allocations(0) {
+    if (params.scaleFactor <= 1.0)
+        throw runtime_error("detector scaleFactor must be greater than 1.");
+
+    if (_cascades.empty() || _cascades.size() > UINT16_MAX)
+        throw runtime_error("detector needs between 1 and 65535 cascades.");
+    for (auto& variants : _cascades) {
+        size_t unscaled = variants->find(1.0);
+        if (variants->scale(unscaled) != 1.0)
+            throw runtime_error("detector cascades have no unscaled variant.");
+        uint16_t base = (*variants)[unscaled].get_base_resolution();
+        if (_baseResolution != 0 && base != _baseResolution)
+            throw runtime_error("detector cascades differ in base resolution.");
+        _baseResolution = base;
+    }
+
+    size_t threads = (params.threads != 0) ? params.threads : max(1u, thread::hardware_concurrency());
+    for (size_t i = 0; i < threads; ++i)
+        _workers.push_back(unique_ptr<scan_worker>(new scan_worker()));
+
+    // the calling thread is worker 0
+    _start_threads(threads - 1);
+}
+
+detector::~detector() noexcept {
+    _stop_threads();
+}
+
+void detector::_start_threads(size_t count) {
+    for (size_t i = 1; i <= count; ++i)
+        _threads.push_back(thread(&detector::_thread_main, this, i));
+}
+
+void detector::_stop_threads() {
+    {
+        lock_guard<mutex> lock(_poolMutex);
+        _stopping = true;
+    }
+    _poolStart.notify_all();
+    for (auto& t : _threads)
+        t.join();
+    _threads.clear();
+}
+
+void detector::_thread_main(size_t worker) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(_poolMutex);
+            _poolStart.wait(lock, [&]() {
+                return _stopping || _generation != seen;
+            });
+            if (_stopping)
+                return;
+            seen = _generation;
+        }
+
+        exception_ptr error;
+        try {
+            _run_worker(worker);
+        } catch (...) {
+            error = current_exception();
+        }
+
+        {
+            lock_guard<mutex> lock(_poolMutex);
+            if (error && !_poolError)
+                _poolError = error;
+            if (--_pending == 0)
+                _poolDone.notify_one();
+        }
+    }
+}
+
+// Integrate frames while there are any left, or run this worker's own jobs
+// and then help the others until none are left.
+void detector::_run_worker(size_t worker) {
+    if (_integrating) {
+        for (size_t frame = _nextFrame++; frame < _batch; frame = _nextFrame++)
+            _integrate(_frames[frame]);
+        return;
+    }
+
+    size_t job;
+    while (_take_task(worker, false, job))
+        _scan(_jobs[job], worker);
+
+    for (size_t i = 1; i < _workers.size(); ++i) {
+        size_t victim = (worker + i) % _workers.size();
+        while (_take_task(victim, true, job))
+            _scan(_jobs[job], worker);
+    }
+}
+
+// Run _run_worker on the calling thread and every pool thread, and wait for
+// all of them.
+void detector::_run_pool() {
+    if (_threads.empty()) {
+        _run_worker(0);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(_poolMutex);
+        ++_generation;
+        _pending = _threads.size();
+    }
+    _poolStart.notify_all();
+
+    // the threads use the detector until they are done, so whatever a task
+    // throws is only rethrown after waiting for them
+    exception_ptr error;
+    try {
+        _run_worker(0);
+    } catch (...) {
+        error = current_exception();
+    }
+
+    unique_lock<mutex> lock(_poolMutex);
+    _poolDone.wait(lock, [&]() {
+        return _pending == 0;
+    });
+    if (!error)
+        error = _poolError;
+    _poolError = nullptr;
+    lock.unlock();
+    if (error)
+        rethrow_exception(error);
+}
+
+// Claim a task from the front (owner) or the back (thief) of a worker's share.
+bool detector::_take_task(size_t worker, bool steal, size_t& task) {
+    auto& range = _workers[worker]->range;
+    uint64_t r = range.load();
+    for (;;) {
+        uint32_t begin = (uint32_t) (r >> 32);
+        uint32_t end = (uint32_t) r;
+        if (begin >= end)
+            return false;
+
+        uint64_t next = steal ? (((uint64_t) begin << 32) | (end - 1)) : (((uint64_t) (begin + 1) << 32) | end);
+        if (range.compare_exchange_weak(r, next)) {
+            task = _order[steal ? end - 1 : begin];
+            return true;
+        }
+    }
+}
+
+// Add a downscaled copy of the frame, returns its index in _sources.
+size_t detector::_add_source(double scale, uint16_t w, uint16_t h) {
+    _sources.push_back(level_source{scale, (uint16_t) (w / scale), (uint16_t) (h / scale)});
+    return _sources.size() - 1;
+}
+
+// Whether source i is made by 2x box decimation of the one before it. Hybrid
+// sources are octaves, but with a scaleFactor of 3 or more some octaves have
+// no level and are skipped, those sources are area averaged instead.
+bool detector::_halved(size_t i) const {
+    return _params.mode == DETECT_HYBRID && _sources[i].scale == 2.0 * _sources[i - 1].scale;
+}
+
+// Buffers for batches of up to frames frames.
+void detector::_size_frames(size_t frames) {
+    while (_frames.size() < frames) {
+        frame_state frame;
+        for (size_t i = 0; i < _sources.size(); ++i) {
+            auto& source = _sources[i];
+            source_pixels pixels;
+            pixels.integral = image_create_padded<double>(source.w, source.h);
+            pixels.squaredIntegral = image_create_padded<double>(source.w, source.h);
+            _allocations += 2;
+
+            if (i > 0) {
+                pixels.lum = image_create_padded<double>(source.w, source.h);
+                ++_allocations;
+                if (!_halved(i)) {
+                    pixels.plan = image_area_plan_create(_sources[i - 1].w, _sources[i - 1].h, source.w, source.h);
+                    ++_allocations;
+                }
+            }
+            frame.sources.push_back(std::move(pixels));
+        }
+        _frames.push_back(std::move(frame));
+    }
+}
+
+// Size every buffer for w x h frames. Only does work when the geometry changes
+// (or on the first call, _frames is never empty after one, even for 0 x 0).
+void detector::_prepare(uint16_t w, uint16_t h) {
+    if (!_frames.empty() && w == _w && h == _h)
+        return;
+
+    _sources.clear();
+    _levels.clear();
+    _frames.clear();
+    _add_source(1.0, w, h);
+
+    for (double s = 1.0;; s *= _params.scaleFactor) {
+        // scale of the source image this window size is scanned on
+        double sourceScale = _source_scale(_params.mode, s);
+
+        uint16_t sourceW = (uint16_t) (w / sourceScale), sourceH = (uint16_t) (h / sourceScale);
+        if (_baseResolution > sourceW || _baseResolution > sourceH)
+            break;
+
+        // the cascades cover whatever scale the source image does not
+        double featureScale = s / sourceScale;
+        auto variant = [&](size_t c) -> const cascade_classifier* {
+            auto& variants = *_cascades[c];
+            size_t v = variants.find(featureScale);
+            if (fabs(variants.scale(v) - featureScale) > 1e-6 * featureScale)
+                throw runtime_error("detector cascades have no variant for a scale.");
+            return &variants[v];
+        };
+
+        uint16_t window = variant(0)->get_base_resolution();
+        if (window > sourceW || window > sourceH)
+            break;
+        if (_params.maxWindow != 0 && window * sourceScale > _params.maxWindow)
+            break;
+        if (window * sourceScale < _params.minWindow)
+            continue;
+
+        // only sources some level is scanned on are built
+        if (_sources.back().scale != sourceScale)
+            _add_source(sourceScale, w, h);
+
+        uint16_t step = (uint16_t) max(1, (int) lround(featureScale * _params.stepFactor));
+        for (uint16_t c = 0; c < _cascades.size(); ++c)
+            _levels.push_back(scale_level{s, _sources.size() - 1, variant(c), c, window, step, cascade_evaluator(), 0, 0, false});
+    }
+    ++_allocations;
+
+    _size_frames(1);
+    for (auto& level : _levels)
+        level.evaluator = cascade_evaluator(*level.cc, _frames[0].sources[level.source].integral.stride);
+    ++_allocations;
+
+    // room for the anytime scan order, one entry per row of windows
+    size_t totalRows = 0;
+    for (auto& l : _levels)
+        totalRows += (size_t) (_sources[l.source].h - l.window) / l.step + 1;
+    _anytimeRows.reserve(totalRows);
+    _levelOrder.reserve(_levels.size());
+
+    // Split every window size into bands of window rows, about four per
+    // thread so there is something left to steal when a band turns out to be
+    // expensive. A band is one task for the levels of all cascades.
+    size_t workers = _workers.size();
+    size_t maxCols = 0;
+    size_t maxChunk = 0;
+    _tasks.clear();
+    for (size_t i = 0; i < _levels.size(); i += _cascades.size()) {
+        auto& l = _levels[i];
+        auto& source = _sources[l.source];
+        size_t rows = (size_t) (source.h - l.window) / l.step + 1;
+        size_t cols = (size_t) (source.w - l.window) / l.step + 1;
+        size_t bands = (workers == 1) ? 1 : min(rows, workers * 4);
+        size_t bandRows = (rows + bands - 1) / bands;
+        size_t coarse = max((uint16_t) 1, _params.coarseStep);
+        bandRows = (bandRows + coarse - 1) / coarse * coarse;
+
+        for (size_t r0 = 0; r0 < rows; r0 += bandRows) {
+            size_t r1 = min(rows, r0 + bandRows);
+            uint16_t y1 = (r1 == rows) ? source.h : (uint16_t) (r1 * l.step);
+            _tasks.push_back(scan_task{i, _cascades.size(), 0, (uint16_t) (r0 * l.step), y1, 0, 0, 0});
+        }
+        maxCols = max(maxCols, cols);
+        maxChunk = max(maxChunk, min(rows, _chunk_rows(cols, coarse)) * cols);
+    }
+
+    _scheduled = 0;
+
+    // any frame may come with a gate, whose test sums the mask columns under
+    // the frame: at most w + 1 of them
+    for (auto& worker : _workers) {
+        worker->means.assign(maxCols, 0.0);
+        worker->stdevs.assign(maxCols, 0.0);
+        worker->passed.assign(maxCols, 0);
+        worker->accepted.assign(maxChunk, 0);
+        worker->open.assign(maxChunk, 0);
+        worker->gateColumns.reserve(maxCols);
+        worker->gatePrefix.reserve(w + 2);
+        worker->survivors.clear();
+        worker->survivors.reserve(maxChunk);
+    }
+    ++_allocations;
+
+    _w = w;
+    _h = h;
+}
+
+// Classify every window position of one band of the task's levels.
+void detector::_scan(scan_task& task, size_t worker) {
+    auto& w = *_workers[worker];
+    task.worker = worker;
+    task.begin = w.detections.size();
+    if (_params.coarseStep > 1) {
+        for (size_t l = task.level; l < task.level + task.levels; ++l)
+            _scan_coarse(_levels[l], task, w);
+    } else if (_params.order == DETECT_BREADTH_FIRST) {
+        for (size_t l = task.level; l < task.level + task.levels; ++l)
+            _scan_breadth_first(_levels[l], task, w);
+    } else _scan_depth_first(task, w);
+    task.end = w.detections.size();
+}
+
+// A row of windows at a time, through every level of the task. With a gate
+// only the runs of open windows in each row go through the cascades.
+void detector::_scan_depth_first(const scan_task& task, scan_worker& w) {
+    const scale_level& first = _levels[task.level];
+    auto& source = _sources[first.source];
+    auto& frame = _frames[task.frame];
+    auto& pixels = frame.sources[first.source];
+    image_view<const double> ii = pixels.integral;
+    image_view<const double> sii = pixels.squaredIntegral;
+    auto& means = w.means;
+    auto& stdevs = w.stdevs;
+    auto& accepted = w.accepted;
+    auto& detections = w.detections;
+
+    uint16_t window = first.window;
+    uint16_t step = first.step;
+    double area = (double) window * window;
+
+    // detections are reported in frame coordinates
+    double toFrame = source.scale;
+    uint16_t frameWindow = (uint16_t) (window * toFrame);
+
+    size_t cols = (size_t) (ii.w - window) / step + 1;
+    if (_gate)
+        _gate_columns(first, frame, cols, w);
+
+    for (uint32_t y = task.y0; y < task.y1 && y + window <= ii.h; y += step) {
+        if (_gate)
+            _gate_row(first, frame, y / step, cols, w, w.open.data());
+
+        for (size_t i0 = 0; i0 < cols;) {
+            if (_gate && !w.open[i0]) {
+                ++i0;
+                continue;
+            }
+            size_t i1 = i0 + 1;
+            while (i1 < cols && (!_gate || w.open[i1]))
+                ++i1;
+
+            for (size_t i = i0; i < i1; ++i) {
+                uint16_t x = (uint16_t) (i * step);
+                double mean = image_integral_rectangle(ii, x, y, window, window) / area;
+                double variance = image_integral_rectangle(sii, x, y, window, window) / area - (mean * mean);
+                means[i - i0] = mean;
+                stdevs[i - i0] = (variance > 0.0) ? sqrt(variance) : 0.0;
+            }
+
+            for (size_t l = task.level; l < task.level + task.levels; ++l) {
+                const scale_level& level = _levels[l];
+                level.evaluator.classify(ii, (uint16_t) (i0 * step), (uint16_t) y, step, i1 - i0, means.data(), stdevs.data(), accepted.data());
+
+                for (size_t i = i0; i < i1; ++i) {
+                    if (accepted[i - i0]) {
+                        uint32_t dx = frame.x + (uint32_t) (i * step * toFrame);
+                        uint32_t dy = frame.y + (uint32_t) (y * toFrame);
+                        detections.push_back(detection{dx, dy, frameWindow, frameWindow, level.cascade});
+                    }
+                }
+            }
+            i0 = i1;
+        }
+    }
+}
+
+static int64_t _floor_div(int64_t v, int64_t d) {
+    return (v >= 0) ? v / d : -((-v + d - 1) / d);
+}
+
+// Blocks the window columns of a level touch: all of them and the range of
+// them on the mask, the same for every row.
+void detector::_gate_columns(const scale_level& level, const frame_state& frame, size_t cols, scan_worker& worker) const {
+    const window_gate& gate = *_gate;
+    double toFrame = _sources[level.source].scale;
+    int64_t size = (uint16_t) (level.window * toFrame);
+    int64_t cell = gate.cell;
+
+    worker.gateColumns.resize(cols);
+    for (size_t i = 0; i < cols; ++i) {
+        int64_t x = (int64_t) frame.x + (uint32_t) (i * level.step * toFrame) - gate.x;
+        int64_t bx0 = _floor_div(x, cell), bx1 = _floor_div(x + size - 1, cell);
+        auto& c = worker.gateColumns[i];
+        c.blocks = (uint32_t) (bx1 - bx0 + 1);
+        c.first = (int32_t) max(bx0, (int64_t) 0);
+        c.last = (int32_t) min(bx1, (int64_t) gate.mask.w - 1);
+    }
+}
+
+// Flags for the windows of one row of a level, after _gate_columns. The
+// blocks set in every mask column of the row's blocks are summed up once, so
+// each window costs two lookups.
+void detector::_gate_row(const scale_level& level, const frame_state& frame, size_t row, size_t cols, scan_worker& worker, uint8_t* flags) const {
+    const window_gate& gate = *_gate;
+    double toFrame = _sources[level.source].scale;
+    int64_t size = (uint16_t) (level.window * toFrame);
+    int64_t cell = gate.cell;
+
+    int64_t y = (int64_t) frame.y + (uint32_t) (row * level.step * toFrame) - gate.y;
+    int64_t by0 = _floor_div(y, cell), by1 = _floor_div(y + size - 1, cell);
+    int64_t my0 = max(by0, (int64_t) 0), my1 = min(by1, (int64_t) gate.mask.h - 1);
+
+    // the mask columns under the row's windows, which lie within the frame
+    int32_t mx0 = cols ? worker.gateColumns[0].first : 0;
+    int32_t mx1 = cols ? worker.gateColumns[cols - 1].last : -1;
+
+    // most rows of a sparse mask are closed all along
+    if (my0 > my1 || mx0 > mx1 || image_integral_rectangle(gate.mask, (uint16_t) mx0, (uint16_t) my0, (uint16_t) (mx1 - mx0 + 1), (uint16_t) (my1 - my0 + 1)) <= 0.0) {
+        fill(flags, flags + cols, 0);
+        return;
+    }
+
+    // prefix[k] is the number of set blocks left of mask column mx0 + k
+    auto& prefix = worker.gatePrefix;
+    prefix.resize(mx1 - mx0 + 2);
+    const double* bottom = gate.mask.row((uint16_t) my1);
+    const double* top = (my0 > 0) ? gate.mask.row((uint16_t) (my0 - 1)) : nullptr;
+    for (int32_t k = mx0 - 1; k <= mx1; ++k)
+        prefix[k - mx0 + 1] = (k < 0) ? 0.0 : top ? bottom[k] - top[k] : bottom[k];
+
+    double minSet = gate.minFraction * (double) (by1 - by0 + 1);
+    for (size_t i = 0; i < cols; ++i) {
+        auto& c = worker.gateColumns[i];
+        double set = (c.first <= c.last) ? prefix[c.last - mx0 + 1] - prefix[c.first - mx0] : 0.0;
+        flags[i] = (set > 0.0 && set >= minSet * c.blocks) ? 1 : 0;
+    }
+}
+
+// Set flags (row major, cols per row) for the windows of rows [row0, row0 +
+// rows) of a level the gate leaves open, all of them without a gate.
+void detector::_gate_flags(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker, vector<uint8_t>& flags) const {
+    if (!_gate) {
+        fill(flags.begin(), flags.begin() + rows * cols, 1);
+        return;
+    }
+
+    _gate_columns(level, frame, cols, worker);
+    for (size_t r = 0; r < rows; ++r)
+        _gate_row(level, frame, row0 + r, cols, worker, flags.data() + r * cols);
+}
+
+// Classify the windows of rows [row0, row0 + rows) of a level whose flag in
+// the worker's accepted buffer (row major, cols per row) is set, breadth first.
+// Leaves 1 for the accepted windows and 0 for everything else.
+void detector::_classify_flagged(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker) {
+    auto& pixels = frame.sources[level.source];
+    image_view<const double> ii = pixels.integral;
+    image_view<const double> sii = pixels.squaredIntegral;
+    auto& accepted = worker.accepted;
+    auto& survivors = worker.survivors;
+
+    uint16_t window = level.window;
+    uint16_t step = level.step;
+    double area = (double) window * window;
+
+    survivors.clear();
+    for (size_t id = 0; id < rows * cols; ++id) {
+        if (!accepted[id])
+            continue;
+
+        uint16_t x = (uint16_t) ((id % cols) * step);
+        uint16_t y = (uint16_t) ((row0 + id / cols) * step);
+        double mean = image_integral_rectangle(ii, x, y, window, window) / area;
+        double variance = image_integral_rectangle(sii, x, y, window, window) / area - (mean * mean);
+        double stdev = (variance > 0.0) ? sqrt(variance) : 0.0;
+
+        // windows on the edge of the integral go through the cascade directly
+        if (x == 0 || y == 0)
+            accepted[id] = level.cc->classify(ii, x, y, mean, stdev) ? 1 : 0;
+        else {
+            accepted[id] = 0;
+            survivors.push_back((int64_t) (y * ii.stride) + x, mean, stdev, (uint32_t) id);
+        }
+    }
+
+    level.evaluator.classify_survivors(ii, survivors);
+    for (auto id : survivors.ids)
+        accepted[id] = 1;
+}
+
+// Report the windows _classify_flagged accepted, in frame coordinates.
+void detector::_add_detections(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker) {
+    double toFrame = _sources[level.source].scale;
+    uint16_t frameWindow = (uint16_t) (level.window * toFrame);
+
+    for (size_t id = 0; id < rows * cols; ++id) {
+        if (worker.accepted[id]) {
+            uint32_t dx = frame.x + (uint32_t) ((id % cols) * level.step * toFrame);
+            uint32_t dy = frame.y + (uint32_t) ((row0 + id / cols) * level.step * toFrame);
+            worker.detections.push_back(detection{dx, dy, frameWindow, frameWindow, level.cascade});
+        }
+    }
+}
+
+// The task's rows of one level, every chunk of rows goes through the cascade
+// one stage at a time.
+void detector::_scan_breadth_first(const scale_level& level, const scan_task& task, scan_worker& w) {
+    auto& source = _sources[level.source];
+    auto& frame = _frames[task.frame];
+
+    size_t rows = (size_t) (source.h - level.window) / level.step + 1;
+    size_t cols = (size_t) (source.w - level.window) / level.step + 1;
+    size_t r0 = task.y0 / level.step;
+    size_t r1 = min(rows, ((size_t) task.y1 + level.step - 1) / level.step);
+    size_t chunkRows = _chunk_rows(cols, 1);
+
+    for (size_t c0 = r0; c0 < r1; c0 += chunkRows) {
+        size_t n = min(r1, c0 + chunkRows) - c0;
+        _gate_flags(level, frame, c0, n, cols, w, w.accepted);
+        _classify_flagged(level, frame, c0, n, cols, w);
+        _add_detections(level, frame, c0, n, cols, w);
+    }
+}
+
+// Coarse to fine: the cascade first runs on every coarseStep'th row and column
+// of window positions. Every coarse window that passes at least refineStages
+// stages flags the positions within coarseStep - 1 of it, and only those are
+// classified (breadth first). Chunks also look at the coarse rows just
+// outside them, so the result does not depend on how rows are split up. With
+// a gate, coarse rows whose neighbourhood is closed are not scanned and only
+// open positions are refined, which gives what the gate lets through of the
+// ungated scan.
+void detector::_scan_coarse(const scale_level& level, const scan_task& task, scan_worker& w) {
+    auto& frame = _frames[task.frame];
+    auto& pixels = frame.sources[level.source];
+    image_view<const double> ii = pixels.integral;
+    image_view<const double> sii = pixels.squaredIntegral;
+
+    uint16_t window = level.window;
+    uint16_t step = level.step;
+    double area = (double) window * window;
+
+    size_t coarse = _params.coarseStep;
+    size_t rows = (size_t) (ii.h - window) / step + 1;
+    size_t cols = (size_t) (ii.w - window) / step + 1;
+    size_t coarseCols = (cols - 1) / coarse + 1;
+    size_t refine = min((size_t) _params.refineStages, level.evaluator.stages());
+    size_t r0 = task.y0 / step;
+    size_t r1 = min(rows, ((size_t) task.y1 + step - 1) / step);
+    size_t chunkRows = _chunk_rows(cols, coarse);
+
+    for (size_t c0 = r0; c0 < r1; c0 += chunkRows) {
+        size_t c1 = min(r1, c0 + chunkRows);
+        fill(w.accepted.begin(), w.accepted.begin() + (c1 - c0) * cols, 0);
+        _gate_flags(level, frame, c0, c1 - c0, cols, w, w.open);
+
+        // coarse rows whose neighbourhood reaches into [c0, c1)
+        size_t first = (c0 >= coarse - 1) ? c0 - (coarse - 1) : 0;
+        first = (first + coarse - 1) / coarse * coarse;
+        for (size_t rc = first; rc < min(rows, c1 + coarse - 1); rc += coarse) {
+            size_t rlo = max(c0, (rc >= coarse - 1) ? rc - (coarse - 1) : 0);
+            size_t rhi = min(c1, rc + coarse);
+            if (_gate && find(w.open.begin() + (rlo - c0) * cols, w.open.begin() + (rhi - c0) * cols, 1) == w.open.begin() + (rhi - c0) * cols)
+                continue;
+
+            uint16_t y = (uint16_t) (rc * step);
+            for (size_t k = 0; k < coarseCols; ++k) {
+                uint16_t x = (uint16_t) (k * coarse * step);
+                double mean = image_integral_rectangle(ii, x, y, window, window) / area;
+                double variance = image_integral_rectangle(sii, x, y, window, window) / area - (mean * mean);
+                w.means[k] = mean;
+                w.stdevs[k] = (variance > 0.0) ? sqrt(variance) : 0.0;
+            }
+
+            level.evaluator.stages_passed(ii, 0, y, (uint16_t) (coarse * step), coarseCols,
+                    w.means.data(), w.stdevs.data(), w.passed.data());
+
+            for (size_t k = 0; k < coarseCols; ++k) {
+                if (w.passed[k] < refine)
+                    continue;
+                size_t ilo = (k * coarse >= coarse - 1) ? k * coarse - (coarse - 1) : 0;
+                size_t ihi = min(cols, k * coarse + coarse);
+                for (size_t r = rlo; r < rhi; ++r)
+                    fill(w.accepted.begin() + (r - c0) * cols + ilo, w.accepted.begin() + (r - c0) * cols + ihi, 1);
+            }
+        }
+
+        if (_gate)
+            for (size_t id = 0; id < (c1 - c0) * cols; ++id)
+                w.accepted[id] &= w.open[id];
+        _classify_flagged(level, frame, c0, c1 - c0, cols, w);
+        _add_detections(level, frame, c0, c1 - c0, cols, w);
+    }
+}
+
+const vector<detection>& detector::detect(const image_view<const double>& lum, const window_gate& gate) {
+    if (gate.cell == 0)
+        throw runtime_error("window_gate cell must be at least 1.");
+
+    _gate = &gate;
+    try {
+        detect(lum);
+    } catch (...) {
+        _gate = nullptr;
+        throw;
+    }
+    _gate = nullptr;
+    return _detections;
+}
+
+void detector::_set_frame(frame_state& frame, const image_view<const double>& lum) {
+    frame.lum = lum;
+    frame.bytes = image_view<const uint8_t>();
+    frame.x = lum.x;
+    frame.y = lum.y;
+}
+
+void detector::_set_frame(frame_state& frame, const image_view<const uint8_t>& bytes) {
+    frame.lum = image_view<const double>();
+    frame.bytes = bytes;
+    frame.x = bytes.x;
+    frame.y = bytes.y;
+}
+
+// Integrals of a frame and of every level source.
+void detector::_integrate(frame_state& frame) {
+    if (frame.bytes.bits)
+        _integrate_pixels(frame, frame.bytes);
+    else _integrate_pixels(frame, frame.lum);
+}
+
+// _integrate from the frame's pixels, the first downscaled source is read
+// from them as well.
+template<typename V>
+void detector::_integrate_pixels(frame_state& frame, const image_view<const V>& pixels) {
+    image_integral(pixels, image_view<double>(frame.sources[0].integral));
+    image_squared_integral(pixels, image_view<double>(frame.sources[0].squaredIntegral));
+
+    for (size_t i = 1; i < _sources.size(); ++i) {
+        auto& source = frame.sources[i];
+        image_view<double> out(source.lum);
+        if (i == 1) {
+            if (_halved(i))
+                image_downscale_2x(pixels, out);
+            else image_downscale_area(pixels, out, source.plan);
+        } else {
+            image_view<const double> previous(frame.sources[i - 1].lum);
+            if (_halved(i))
+                image_downscale_2x(previous, out);
+            else image_downscale_area(previous, out, source.plan);
+        }
+        image_integral(image_view<const double>(source.lum), image_view<double>(source.integral));
+        image_squared_integral(image_view<const double>(source.lum), image_view<double>(source.squaredIntegral));
+    }
+}
+
+// Jobs for batches of frames frames: every task for every frame, the frames
+// of a task one after the other so they share the level's cascade in cache.
+// Dealt out round robin so every worker starts with a mix of scales, each
+// worker's share is a contiguous slice of _order.
+void detector::_schedule(size_t frames) {
+    if (_scheduled == frames)
+        return;
+
+    size_t capacity = _jobs.capacity() + _order.capacity();
+    _jobs.clear();
+    for (auto& task : _tasks) {
+        for (size_t f = 0; f < frames; ++f) {
+            _jobs.push_back(task);
+            _jobs.back().frame = f;
+        }
+    }
+
+    size_t workers = _workers.size();
+    _order.clear();
+    for (size_t k = 0; k < workers; ++k)
+        for (size_t j = k; j < _jobs.size(); j += workers)
+            _order.push_back((uint32_t) j);
+    if (_jobs.capacity() + _order.capacity() != capacity)
+        ++_allocations;
+    _scheduled = frames;
+}
+
+// Integrate and scan the first frames frames of _frames, whose lum is set.
+// Leaves the detections of every job in its worker's buffer.
+void detector::_run(size_t frames) {
+    _schedule(frames);
+    for (auto& worker : _workers)
+        worker->detections.clear();
+
+    // a single frame is integrated on the calling thread, a batch by the pool
+    _batch = frames;
+    if (frames == 1 || _threads.empty()) {
+        for (size_t f = 0; f < frames; ++f)
+            _integrate(_frames[f]);
+    } else {
+        _nextFrame = 0;
+        _integrating = true;
+        _run_pool();
+        _integrating = false;
+    }
+
+    size_t share = 0;
+    for (size_t k = 0; k < _workers.size(); ++k) {
+        size_t count = (_jobs.size() + _workers.size() - 1 - k) / _workers.size();
+        _workers[k]->range.store(((uint64_t) share << 32) | (share + count));
+        share += count;
+    }
+    _run_pool();
+}
+
+// Which worker ends up with which job changes from call to call, so let every
+// worker hold all the detections of one. capacity is what the buffers held
+// before the call.
+void detector::_reserve_detections(size_t total, size_t capacity) {
+    size_t newCapacity = 0;
+    for (auto& worker : _workers) {
+        if (_workers.size() > 1 && worker->detections.capacity() < total)
+            worker->detections.reserve(total);
+        newCapacity += worker->detections.capacity();
+    }
+    if (newCapacity != capacity)
+        ++_allocations;
+}
+
+// Detection buffer capacity of all workers.
+size_t detector::_detections_capacity() const {
+    size_t capacity = 0;
+    for (auto& worker : _workers)
+        capacity += worker->detections.capacity();
+    return capacity;
+}
+
+// detect() on a frame of luminance or 8 bit pixels.
+template<typename V>
+const vector<detection>& detector::_detect(const image_view<const V>& lum) {
+    _prepare(lum.w, lum.h);
+    size_t capacity = _detections_capacity() + _detections.capacity();
+
+    _set_frame(_frames[0], lum);
+    _run(1);
+
+    // every job recorded where its detections went, gather them in order
+    _detections.clear();
+    for (auto& job : _jobs) {
+        auto& detections = _workers[job.worker]->detections;
+        _detections.insert(_detections.end(), detections.begin() + job.begin, detections.begin() + job.end);
+    }
+
+    _reserve_detections(_detections.size(), capacity - _detections.capacity());
+    return _detections;
+}
+
+const vector<detection>& detector::detect(const image_view<const double>& lum) {
+    return _detect(lum);
+}
+
+const vector<detection>& detector::detect(const image_view<const uint8_t>& lum) {
+    return _detect(lum);
+}
+
+const vector<detection>& detector::detect(const uint8_t* pixels, uint16_t w, uint16_t h, size_t stride) {
+    if (stride < w)
+        throw runtime_error("detector stride is smaller than the width.");
+    return _detect(image_view<const uint8_t>(pixels, w, h, stride));
+}
+
+const vector<vector<detection>>& detector::detect(const vector<image_view<const double>>& frames) {
+    if (frames.empty()) {
+        _batchDetections.clear();
+        return _batchDetections;
+    }
+    for (auto& frame : frames)
+        if (frame.w != frames[0].w || frame.h != frames[0].h)
+            throw runtime_error("detector batch frames differ in size.");
+
+    _prepare(frames[0].w, frames[0].h);
+    size_t capacity = _detections_capacity();
+    if (_batchDetections.size() != frames.size()) {
+        _batchDetections.resize(frames.size());
+        ++_allocations;
+    }
+    for (auto& ds : _batchDetections)
+        capacity += ds.capacity();
+
+    _size_frames(frames.size());
+    for (size_t f = 0; f < frames.size(); ++f)
+        _set_frame(_frames[f], frames[f]);
+    _run(frames.size());
+
+    size_t total = 0;
+    for (auto& ds : _batchDetections)
+        ds.clear();
+    for (auto& job : _jobs) {
+        auto& detections = _workers[job.worker]->detections;
+        auto& ds = _batchDetections[job.frame];
+        ds.insert(ds.end(), detections.begin() + job.begin, detections.begin() + job.end);
+        total += job.end - job.begin;
+    }
+
+    size_t outputs = 0;
+    for (auto& ds : _batchDetections)
+        outputs += ds.capacity();
+    _reserve_detections(total, capacity - outputs);
+    return _batchDetections;
+}
+
+// Rows of windows of a level.
+static size_t _level_rows(uint16_t sourceH, uint16_t window, uint16_t step) {
+    return (size_t) (sourceH - window) / step + 1;
+}
+
+void detector::begin(const image_view<const double>& lum) {
+    _prepare(lum.w, lum.h);
+    _workers[0]->detections.clear();
+    _set_frame(_frames[0], lum);
+    _integrate(_frames[0]);
+
+    // levels that found something in the last scan that reached them first,
+    // then the cheapest (fewest windows) ones
+    _anytimeTotal = 0;
+    _levelOrder.clear();
+    for (uint32_t l = 0; l < _levels.size(); ++l) {
+        auto& level = _levels[l];
+        auto& source = _sources[level.source];
+        if (level.reached)
+            level.prior = level.hits;
+        level.hits = 0;
+        level.reached = false;
+        _anytimeTotal += _level_rows(source.h, level.window, level.step) * ((size_t) (source.w - level.window) / level.step + 1);
+        _levelOrder.push_back(l);
+    }
+    sort(_levelOrder.begin(), _levelOrder.end(), [this](uint32_t a, uint32_t b) {
+        if (_levels[a].prior != _levels[b].prior)
+            return _levels[a].prior > _levels[b].prior;
+        return _levels[a].window * _sources[_levels[a].source].scale > _levels[b].window * _sources[_levels[b].source].scale;
+    });
+
+    // The levels that found something, then the others: every 4th row of
+    // each, then the rows in between, so a scan cut short has looked at the
+    // whole frame at every scale of the group.
+    _anytimeRows.clear();
+    auto likely = partition_point(_levelOrder.begin(), _levelOrder.end(), [this](uint32_t l) {
+        return _levels[l].prior > 0;
+    });
+    for (auto group : {make_pair(_levelOrder.begin(), likely), make_pair(likely, _levelOrder.end())}) {
+        for (uint32_t offset : {0u, 2u, 1u, 3u}) {
+            for (auto it = group.first; it != group.second; ++it) {
+                auto& level = _levels[*it];
+                size_t rows = _level_rows(_sources[level.source].h, level.window, level.step);
+                for (size_t r = offset; r < rows; r += 4)
+                    _anytimeRows.push_back(make_pair(*it, (uint32_t) r));
+            }
+        }
+    }
+    _anytimeNext = 0;
+    _anytimeScanned = 0;
+}
+
+// Windows in the next row of the anytime order.
+size_t detector::_anytime_cols() const {
+    auto& level = _levels[_anytimeRows[_anytimeNext].first];
+    return (size_t) (_sources[level.source].w - level.window) / level.step + 1;
+}
+
+// Scan the next row of the anytime order on the calling thread.
+void detector::_anytime_row() {
+    auto& row = _anytimeRows[_anytimeNext];
+    auto& level = _levels[row.first];
+    uint16_t y = (uint16_t) (row.second * level.step);
+    scan_task task{row.first, 1, 0, y, (uint16_t) (y + 1), 0, 0, 0};
+    _scan(task, 0);
+
+    level.hits += task.end - task.begin;
+    level.reached = true;
+    _anytimeScanned += _anytime_cols();
+    ++_anytimeNext;
+}
+
+bool detector::resume(size_t windows) {
+    for (size_t scanned = 0; _anytimeNext < _anytimeRows.size();) {
+        size_t cols = _anytime_cols();
+        if (scanned > 0 && scanned + cols > windows)
+            break;
+        _anytime_row();
+        scanned += cols;
+    }
+    return _anytimeNext == _anytimeRows.size();
+}
+
+const vector<detection>& detector::detect(const image_view<const double>& lum, const detect_budget& budget) {
+    auto start = chrono::steady_clock::now();
+    begin(lum);
+
+    while (_anytimeNext < _anytimeRows.size()) {
+        if (budget.windows != 0 && _anytimeScanned + _anytime_cols() > budget.windows)
+            break;
+        if (budget.milliseconds > 0.0 && chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() >= budget.milliseconds)
+            break;
+        _anytime_row();
+    }
+    return found();
+}
+
+const vector<detection>& detector::found() const {
+    return _workers[0]->detections;
+}
+
+double detector::progress() const {
+    return (_anytimeTotal == 0) ? 1.0 : (double) _anytimeScanned / _anytimeTotal;
+}
+
+vector<detection> detect(const cascade_classifier& cc,
+        const image_view<const double>& lum,
+        const detect_params& params) {
+    detector d(cc, params);
+    return d.detect(lum);
+}
@@ -0,0 +1,356 @@
+#ifndef __detector_h
+#define __detector_h
+
+#include "cascade_classifier.h"
+#include "cascade_evaluator.h"
+#include "ppm.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// x and y are 32 bit so detections in images too large for one image<T>
+// (see tiled_detector) can be reported. cascade is the index of the cascade
+// that accepted the window, for detectors running several (0 otherwise).
+struct detection {
+    uint32_t x;
+    uint32_t y;
+    uint16_t w;
+    uint16_t h;
+    uint16_t cascade;
+};
+
+enum detect_mode {
+    // One integral image of the frame, the cascade's features are scaled up
+    // for every window size.
+    DETECT_SCALE_FEATURES,
+    // The frame is downscaled into a luminance pyramid with an integral per
+    // level, and the unscaled cascade runs on every level.
+    DETECT_PYRAMID,
+    // Pyramid with octave (2x) levels only. Scales between octaves are
+    // covered by scaling the cascade by at most 2x on the octave below.
+    DETECT_HYBRID
+};
+
+enum detect_order {
+    // Rows of adjacent windows go through the whole cascade together.
+    DETECT_DEPTH_FIRST,
+    // Each stage runs over the packed list of windows that passed the stage
+    // before it, a chunk of rows at a time (see
+    // cascade_evaluator::classify_survivors).
+    DETECT_BREADTH_FIRST
+};
+
+struct detect_params {
+    detect_mode mode = DETECT_SCALE_FEATURES;
+    // Ratio between successive window sizes (or pyramid levels).
+    double scaleFactor = 1.25;
+    // Window step in base resolution pixels. It is multiplied by the scale, so
+    // large windows move in proportionally larger steps.
+    double stepFactor = 1.0;
+    detect_order order = DETECT_DEPTH_FIRST;
+    // Coarse to fine scanning. With coarseStep > 1 the cascade first runs on
+    // a grid coarseStep times coarser than the window step, and the full
+    // resolution positions around a coarse window are only scanned if it
+    // passed at least refineStages stages. Trades some recall for speed.
+    uint16_t coarseStep = 1;
+    uint16_t refineStages = 1;
+    // Threads scanning a frame, including the calling one. 0 uses one per
+    // hardware thread.
+    unsigned threads = 1;
+    // Window sizes scanned, in frame pixels. maxWindow 0 scans up to the size
+    // of the frame.
+    uint16_t minWindow = 0;
+    uint16_t maxWindow = 0;
+};
+
+// Restricts a scan to part of the frame. mask is the integral of a 0 / 1 mask
+// whose pixels each stand for a cell x cell block of frame pixels, the first
+// one at (x, y) in frame coordinates; blocks off the mask are unset. A window
+// is only classified when at least minFraction of the blocks it touches, and
+// at least one, are set. Windows skipped this way never reach the cascade.
+struct window_gate {
+    image_view<const double> mask;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint16_t cell = 1;
+    double minFraction = 0.0;
+};
+
+// Limits of an anytime scan (see detector::begin), 0 is no limit. The time
+// includes computing the integrals.
+struct detect_budget {
+    double milliseconds = 0.0;
+    size_t windows = 0;
+};
+
+// Scales the cascade has to be available at for params, covering windows up to
+// the largest frame an image can hold.
+std::vector<double> detect_cascade_scales(const detect_params& params, uint16_t baseResolution);
+
+// Reusable detection context for streaming. The integral images, pyramid,
+// per row window buffers and result list are owned here and
+// sized on first use, so detecting on frames of the same size again does not
+// touch the heap. allocations() counts every time one of those buffers had to
+// be (re)allocated.
+//
+// With params.threads > 1 every scale is split into bands of window rows and
+// the (scale, band) tasks are spread over a pool of threads owned by the
+// detector. Threads take tasks from their own share first and then steal from
+// the others, so scales and regions where many windows survive do not leave
+// threads idle. Each thread keeps its own candidate and detection buffers and
+// the results are concatenated in task order after the scan, without locks,
+// so the output is the same for any number of threads.
+//
+// A detector can run several cascades, e.g. frontal and profile models or
+// rotated and mirrored views of one (see cascade_classifier::transformed),
+// with the same base resolution. The integrals and pyramid are computed once
+// per frame for all of them, and every band of rows is scanned by all of
+// them together: the mean and deviation of each window are computed once and
+// every cascade classifies it in turn, while its integrals are in cache.
+// Detections are tagged with the index of their cascade.
+//
+// detect() itself is not thread safe, use one detector per calling thread.
+// Detectors only read their cascade, so they can all share one (or one
+// cascade_scales) without copies.
+class detector {
+public:
+    // Builds the scaled cascade variants params needs.
+    detector(const cascade_classifier& cc, const detect_params& params = detect_params());
+    // Shares prebuilt variants (see detect_cascade_scales) with other detectors.
+    detector(std::shared_ptr<const cascade_scales> cascades, const detect_params& params = detect_params());
+    // Several cascades, detection::cascade is the index in cascades.
+    detector(const std::vector<cascade_classifier>& cascades, const detect_params& params = detect_params());
+    detector(const std::vector<std::shared_ptr<const cascade_scales>>& cascades, const detect_params& params = detect_params());
+    ~detector() noexcept;
+
+    detector(const detector&) = delete;
+    detector& operator=(const detector&) = delete;
+
+    // Scan lum for windows accepted by the cascade. lum may be a view into a
+    // larger frame, in which case only that region is scanned and detections
+    // are reported in the coordinates of the frame. The result stays valid
+    // until the next call.
+    const std::vector<detection>& detect(const image_view<const double>& lum);
+    // Only windows gate leaves open are classified. gate must stay valid
+    // during the call.
+    const std::vector<detection>& detect(const image_view<const double>& lum, const window_gate& gate);
+
+    // Same on 8 bit luminance in the caller's memory, e.g. the Y plane of a
+    // camera's YUV frames: stride is in bytes and may include row padding.
+    // The integrals (and the first pyramid level) are computed straight from
+    // the pixels, nothing is converted or copied first.
+    const std::vector<detection>& detect(const uint8_t* pixels, uint16_t w, uint16_t h, size_t stride);
+    const std::vector<detection>& detect(const image_view<const uint8_t>& lum);
+
+    // Detect in a batch of frames of the same size, result i holds the
+    // detections of frames[i]. The frames are integrated in parallel, then
+    // every band of every scale is scanned for all frames back to back, so
+    // the pool is started twice per batch rather than once per frame and
+    // each scale's cascade is loaded once for all of them. Every frame has
+    // its own integrals, memory grows with the batch size. The result stays
+    // valid until the next call.
+    const std::vector<std::vector<detection>>& detect(const std::vector<image_view<const double>>& frames);
+
+    // Anytime detection, on the calling thread only. begin() computes the
+    // integrals of lum and orders the rows of windows: scales that found
+    // something in the previous frame before the others (largest windows
+    // first), and within each group every 4th row of every scale before the
+    // rows in between, so whatever part of the scan is done covers the whole
+    // frame at the likely scales first. resume() then scans rows in that
+    // order, about `windows` windows per call (at least one row), and returns
+    // true once all are done; found() holds the detections so far, in scan
+    // order. lum does not have to stay valid after begin().
+    void begin(const image_view<const double>& lum);
+    bool resume(size_t windows);
+    const std::vector<detection>& found() const;
+    // Fraction of the windows of the frame scanned since begin().
+    double progress() const;
+
+    // begin() and resume() until budget runs out, returns found().
+    const std::vector<detection>& detect(const image_view<const double>& lum, const detect_budget& budget);
+
+    size_t allocations() const {
+        return _allocations;
+    }
+
+private:
+    // Geometry of a downscaled copy of the frame. Source 0 is the frame
+    // itself. Every other source is downscaled from the one before it, by
+    // area averaging or, for the next octave, 2x box decimation (see
+    // _halved).
+    struct level_source {
+        double scale;
+        uint16_t w;
+        uint16_t h;
+    };
+
+    // Pixels of one source of one frame: its integrals and, except for
+    // source 0, the downscaled copy and the plan that made it.
+    struct source_pixels {
+        image<double> lum;
+        image<double> integral;
+        image<double> squaredIntegral;
+        image_area_plan plan;
+    };
+
+    // One frame of a batch (a single frame is a batch of one): the region of
+    // the frame being scanned, as luminance or 8 bit pixels (the other view
+    // is empty), where it starts in the frame and the pixels of every source.
+    struct frame_state {
+        image_view<const double> lum;
+        image_view<const uint8_t> bytes;
+        uint32_t x;
+        uint32_t y;
+        std::vector<source_pixels> sources;
+    };
+
+    // One window size of the scan for one cascade: cc (a variant of
+    // _cascades[cascade] scaled as needed) runs over the integrals of
+    // _sources[source], a row of windows at a time through evaluator. The
+    // levels of all cascades at one window size are adjacent. hits counts
+    // the detections of the current anytime scan, prior those of the last
+    // one that reached the level.
+    struct scale_level {
+        double scale;
+        size_t source;
+        const cascade_classifier* cc;
+        uint16_t cascade;
+        uint16_t window;
+        uint16_t step;
+        cascade_evaluator evaluator;
+        size_t hits;
+        size_t prior;
+        bool reached;
+    };
+
+    size_t _add_source(double scale, uint16_t w, uint16_t h);
+
+    // Window rows [y0, y1) of levels [level, level + levels) (the same
+    // window size for several cascades) of one frame. The thread that runs
+    // it leaves its detections in [begin, end) of its own buffer.
+    struct scan_task {
+        size_t level;
+        size_t levels;
+        size_t frame;
+        uint16_t y0;
+        uint16_t y1;
+        size_t worker;
+        size_t begin;
+        size_t end;
+    };
+
+    // Mask blocks the windows of one column of a level touch: blocks in all,
+    // [first, last] of them on the mask.
+    struct gate_column {
+        int32_t first;
+        int32_t last;
+        uint32_t blocks;
+    };
+
+    // Per thread state. range packs the [begin, end) slice of _order this
+    // worker has left: the owner takes from the front, thieves from the back.
+    // means, stdevs and passed hold one row of windows, accepted and open a
+    // chunk of rows for breadth first and coarse to fine scans. gateColumns
+    // and gatePrefix are the scratch of the gate test (see _gate_row).
+    struct scan_worker {
+        std::atomic<uint64_t> range;
+        std::vector<double> means;
+        std::vector<double> stdevs;
+        std::vector<uint16_t> passed;
+        std::vector<uint8_t> accepted;
+        std::vector<uint8_t> open;
+        std::vector<gate_column> gateColumns;
+        std::vector<double> gatePrefix;
+        cascade_survivors survivors;
+        std::vector<detection> detections;
+    };
+
+    void _prepare(uint16_t w, uint16_t h);
+    bool _halved(size_t i) const;
+    void _size_frames(size_t frames);
+    void _set_frame(frame_state& frame, const image_view<const double>& lum);
+    void _set_frame(frame_state& frame, const image_view<const uint8_t>& bytes);
+    template<typename V>
+    const std::vector<detection>& _detect(const image_view<const V>& lum);
+    void _integrate(frame_state& frame);
+    template<typename V>
+    void _integrate_pixels(frame_state& frame, const image_view<const V>& pixels);
+    void _schedule(size_t frames);
+    void _run(size_t frames);
+    void _run_pool();
+    size_t _detections_capacity() const;
+    void _reserve_detections(size_t total, size_t capacity);
+    size_t _anytime_cols() const;
+    void _anytime_row();
+    void _start_threads(size_t count);
+    void _stop_threads();
+    void _thread_main(size_t worker);
+    void _run_worker(size_t worker);
+    bool _take_task(size_t worker, bool steal, size_t& task);
+    void _scan(scan_task& task, size_t worker);
+    void _scan_depth_first(const scan_task& task, scan_worker& worker);
+    void _scan_breadth_first(const scale_level& level, const scan_task& task, scan_worker& worker);
+    void _scan_coarse(const scale_level& level, const scan_task& task, scan_worker& worker);
+    void _gate_columns(const scale_level& level, const frame_state& frame, size_t cols, scan_worker& worker) const;
+    void _gate_row(const scale_level& level, const frame_state& frame, size_t row, size_t cols, scan_worker& worker, uint8_t* flags) const;
+    void _gate_flags(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker, std::vector<uint8_t>& flags) const;
+    void _classify_flagged(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker);
+    void _add_detections(const scale_level& level, const frame_state& frame, size_t row0, size_t rows, size_t cols, scan_worker& worker);
+
+    std::vector<std::shared_ptr<const cascade_scales>> _cascades;
+    detect_params _params;
+    uint16_t _baseResolution;
+
+    uint16_t _w;
+    uint16_t _h;
+    std::vector<level_source> _sources;
+    std::vector<scale_level> _levels;
+    std::vector<frame_state> _frames;
+    // the tasks of one frame, and the jobs (tasks of every frame of a batch
+    // of _scheduled frames) the workers take from
+    std::vector<scan_task> _tasks;
+    std::vector<scan_task> _jobs;
+    std::vector<uint32_t> _order;
+    size_t _scheduled;
+    std::vector<std::unique_ptr<scan_worker>> _workers;
+    std::vector<detection> _detections;
+    std::vector<std::vector<detection>> _batchDetections;
+
+    // the gate, if any, published to the threads with _generation
+    const window_gate* _gate;
+
+    // anytime scan: (level, row) in scan order and how far it got
+    std::vector<uint32_t> _levelOrder;
+    std::vector<std::pair<uint32_t, uint32_t>> _anytimeRows;
+    size_t _anytimeNext;
+    size_t _anytimeScanned;
+    size_t _anytimeTotal;
+
+    std::vector<std::thread> _threads;
+    std::mutex _poolMutex;
+    std::condition_variable _poolStart;
+    std::condition_variable _poolDone;
+    uint64_t _generation;
+    size_t _pending;
+    // the first exception a pool thread's task threw, _run_pool rethrows it
+    std::exception_ptr _poolError;
+    bool _stopping;
+    // the pool integrates the frames of a batch (claiming them through
+    // _nextFrame) instead of scanning
+    bool _integrating;
+    size_t _batch;
+    std::atomic<size_t> _nextFrame;
+
+    size_t _allocations;
+};
+
+// One-shot detection with a temporary detector.
+std::vector<detection> detect(const cascade_classifier& cc,
+        const image_view<const double>& lum,
+        const detect_params& params = detect_params());
+
+#endif
@@ -1,6 +1,8 @@
 
 #include "feature.h"
 #include <vector>
+#include <cmath>
+#include <algorithm>
 
 using namespace std;
 
@@ -8,19 +10,19 @@ feature feature_create(feature_type type, uint16_t xc, uint16_t yc, uint16_t w,
     return feature{ type, w, h, xc, yc};
 }
 
-static double _rect_value(const image<double>& ii,
+static double _rect_value(const image_view<const double>& ii,
         uint16_t ix, uint16_t iy,
         uint16_t rx, uint16_t ry,
         uint16_t rw, uint16_t rh) {
-    double value = (*ii.bits)[((iy + ry + rh - 1) * ii.w)+(ix + rx + rw - 1)];
-    if ((ix + rx) > 0) value -= (*ii.bits)[((iy + ry + rh - 1) * ii.w)+(ix + rx - 1)];
-    if ((iy + ry) > 0) value -= (*ii.bits)[((iy + ry - 1) * ii.w)+(ix + rx + rw - 1)];
-    if ((ix + rx) > 0 && (iy + ry) > 0) value += (*ii.bits)[((iy + ry - 1) * ii.w)+(ix + rx - 1)];
+    double value = ii.bits[((iy + ry + rh - 1) * ii.stride)+(ix + rx + rw - 1)];
+    if ((ix + rx) > 0) value -= ii.bits[((iy + ry + rh - 1) * ii.stride)+(ix + rx - 1)];
+    if ((iy + ry) > 0) value -= ii.bits[((iy + ry - 1) * ii.stride)+(ix + rx + rw - 1)];
+    if ((ix + rx) > 0 && (iy + ry) > 0) value += ii.bits[((iy + ry - 1) * ii.stride)+(ix + rx - 1)];
 
     return value;
 }
 
-double feature_value(const feature& f, const image<double>& ii, uint16_t x, uint16_t y) {
+double feature_value(const feature& f, const image_view<const double>& ii, uint16_t x, uint16_t y) {
     switch (f.type) {
         case A:
             return _rect_value(ii, x, y, f.xc + (f.width / 2), f.yc, f.width / 2, f.height) -
@@ -52,6 +54,41 @@ double feature_value(const feature& f, const image<double>& ii, uint16_t x, uint
     return 0.0;
 }
 
+size_t feature_rects(const feature& f, feature_rect rects[4]) {
+    uint16_t w2 = f.width / 2, h2 = f.height / 2;
+    uint16_t w3 = f.width / 3, h3 = f.height / 3;
+
+    switch (f.type) {
+        case A:
+            rects[0] = feature_rect{(uint16_t) (f.xc + w2), f.yc, w2, f.height, 1};
+            rects[1] = feature_rect{f.xc, f.yc, w2, f.height, -1};
+            return 2;
+        case B:
+            rects[0] = feature_rect{f.xc, f.yc, f.width, h2, 1};
+            rects[1] = feature_rect{f.xc, (uint16_t) (f.yc + h2), f.width, h2, -1};
+            return 2;
+        case C:
+            rects[0] = feature_rect{(uint16_t) (f.xc + w3), f.yc, w3, f.height, 1};
+            rects[1] = feature_rect{f.xc, f.yc, w3, f.height, -1};
+            rects[2] = feature_rect{(uint16_t) (f.xc + (f.width * 2 / 3)), f.yc, w3, f.height, -1};
+            return 3;
+        case CT:
+            rects[0] = feature_rect{f.xc, (uint16_t) (f.yc + h3), f.width, h3, 1};
+            rects[1] = feature_rect{f.xc, f.yc, f.width, h3, -1};
+            rects[2] = feature_rect{f.xc, (uint16_t) (f.yc + (f.height * 2 / 3)), f.width, h3, -1};
+            return 3;
+        case D:
+            rects[0] = feature_rect{(uint16_t) (f.xc + w2), f.yc, w2, h2, 1};
+            rects[1] = feature_rect{f.xc, (uint16_t) (f.yc + h2), w2, h2, 1};
+            rects[2] = feature_rect{(uint16_t) (f.xc + w2), (uint16_t) (f.yc + h2), w2, h2, -1};
+            rects[3] = feature_rect{f.xc, f.yc, w2, h2, -1};
+            return 4;
+        default:
+            break;
+    }
+    return 0;
+}
+
 void feature_scale(feature& f, double s) {
     f.width *= s;
     f.height *= s;
@@ -59,6 +96,72 @@ void feature_scale(feature& f, double s) {
     f.yc *= s;
 }
 
+// Width / height a feature of this type is split into (2 halves, 3 thirds..)
+static uint16_t _width_parts(feature_type type) {
+    return (type == A || type == D) ? 2 : (type == C) ? 3 : 1;
+}
+
+static uint16_t _height_parts(feature_type type) {
+    return (type == B || type == D) ? 2 : (type == CT) ? 3 : 1;
+}
+
+uint32_t feature_area(const feature& f) {
+    uint16_t wp = _width_parts(f.type);
+    uint16_t hp = _height_parts(f.type);
+    return (uint32_t) ((f.width / wp) * wp) * ((f.height / hp) * hp);
+}
+
+static uint16_t _scaled_extent(uint16_t extent, double s, uint16_t parts, uint16_t window) {
+    long scaled = max(1L, lround(extent * s / parts)) * parts;
+    while (scaled > window && scaled > parts)
+        scaled -= parts;
+    return (uint16_t) scaled;
+}
+
+feature feature_scaled(const feature& f, double s, uint16_t window) {
+    feature scaled = f;
+    scaled.width = _scaled_extent(f.width, s, _width_parts(f.type), window);
+    scaled.height = _scaled_extent(f.height, s, _height_parts(f.type), window);
+    scaled.xc = (uint16_t) min(lround(f.xc * s), (long) (window - scaled.width));
+    scaled.yc = (uint16_t) min(lround(f.yc * s), (long) (window - scaled.height));
+    return scaled;
+}
+
+feature feature_transformed(const feature& f, view_transform t, uint16_t window, int& sign) {
+    // where the x and y axes of the window end up: swapped or not, and the
+    // direction (1 or -1) each one points in afterwards
+    static const int axes[][3] = {
+        {0, 1, 1}, {1, 1, -1}, {0, -1, -1}, {1, -1, 1}, {0, -1, 1}, {0, 1, -1}
+    };
+    bool swap = axes[t][0] != 0;
+    int dx = axes[t][1], dy = axes[t][2];
+
+    uint16_t w = (uint16_t) (f.width / _width_parts(f.type) * _width_parts(f.type));
+    uint16_t h = (uint16_t) (f.height / _height_parts(f.type) * _height_parts(f.type));
+    uint16_t x = (dx > 0) ? f.xc : (uint16_t) (window - f.xc - w);
+    uint16_t y = (dy > 0) ? f.yc : (uint16_t) (window - f.yc - h);
+
+    // A compares right with left, B top with bottom and D the diagonals, so
+    // they change sign with the direction of the axes they compare along
+    feature_type type = f.type;
+    sign = 1;
+    if (f.type == A)
+        sign = swap ? -dx : dx;
+    else if (f.type == B)
+        sign = swap ? -dy : dy;
+    else if (f.type == D)
+        sign = dx * dy;
+
+    if (!swap)
+        return feature{type, w, h, x, y};
+
+    if (type == A || type == B)
+        type = (type == A) ? B : A;
+    else if (type == C || type == CT)
+        type = (type == C) ? CT : C;
+    return feature{type, h, w, y, x};
+}
+
 vector<feature> generate_feature_set(uint16_t baseResolution) {
     vector<feature> featureSet;
     uint16_t minWidth, minHeight, width, height, x, y;
@@ -17,9 +17,45 @@ struct feature {
 };
 
 feature feature_create(feature_type type, uint16_t xc, uint16_t yc, uint16_t w, uint16_t h);
-double feature_value(const feature& f, const image<double>& ii, uint16_t x, uint16_t y);
+double feature_value(const feature& f, const image_view<const double>& ii, uint16_t x, uint16_t y);
+
+struct feature_rect {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+    int sign;
+};
+
+// The rectangles feature_value adds up (sign +1) or subtracts (sign -1), in the
+// order it does so. The first one is always added. Returns how many of the 4
+// were filled in.
+size_t feature_rects(const feature& f, feature_rect rects[4]);
 void feature_scale(feature& f, double s);
 
+// Area covered by the feature's rectangles (sizes that do not split evenly
+// lose the remainder).
+uint32_t feature_area(const feature& f);
+
+// Copy of f for a window s times larger. Sizes are rounded to the nearest
+// value the feature type splits evenly and the feature is kept inside a
+// window x window box.
+feature feature_scaled(const feature& f, double s, uint16_t window);
+
+// Ways of turning or flipping a window. Rotations are clockwise, like
+// image_rotate_90 / 180 / 270. VIEW_MIRROR_HORIZONTAL swaps left and right,
+// VIEW_MIRROR_VERTICAL top and bottom (like image_mirror_vertical).
+enum view_transform {
+    VIEW_IDENTITY, VIEW_ROTATE_90, VIEW_ROTATE_180, VIEW_ROTATE_270, VIEW_MIRROR_HORIZONTAL, VIEW_MIRROR_VERTICAL
+};
+
+// The feature that, on a window transformed by t, measures what f measures on
+// the window itself. Turning a two or four rectangle feature can swap its
+// positive and negative rectangles, sign is then -1 (the value is negated)
+// and 1 otherwise. Sizes that do not split evenly lose the remainder, which
+// does not change the value.
+feature feature_transformed(const feature& f, view_transform t, uint16_t window, int& sign);
+
 std::vector<feature> generate_feature_set(uint16_t baseResolution);
 
 #endif
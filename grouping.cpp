@@ -0,0 +1,289 @@
+
+#include "grouping.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+static const uint32_t NONE = UINT32_MAX;
+
+double detection_iou(const detection& a, const detection& b) {
+    double iw = (double) min(a.x + a.w, b.x + b.w) - max(a.x, b.x);
+    double ih = (double) min(a.y + a.h, b.y + b.h) - max(a.y, b.y);
+    if (iw <= 0.0 || ih <= 0.0)
+        return 0.0;
+    double intersection = iw * ih;
+    return intersection / ((double) a.w * a.h + (double) b.w * b.h - intersection);
+}
+
+detection_grouper::detection_grouper(const group_params& params) :
+_params(params),
+_grid(),
+_levelBegin(),
+_levelMax(),
+_parent(),
+_support(),
+_order(),
+_rank(),
+_sums(),
+_counts(),
+_rootOf(),
+_groups(),
+_ranking(),
+_sorted() {
+    if (params.method == GROUP_NMS && (params.overlap <= 0.0 || params.overlap > 1.0))
+        throw runtime_error("grouping overlap must be in (0, 1].");
+    if (params.method == GROUP_NEIGHBORS && params.similarity < 0.0)
+        throw runtime_error("grouping similarity must not be negative.");
+}
+
+detection_grouper::~detection_grouper() noexcept {
+}
+
+const vector<detection_group>& detection_grouper::group(const vector<detection>& ds) {
+    if (ds.size() >= NONE)
+        throw runtime_error("too many detections to group.");
+    for (auto& d : ds)
+        if (d.x >= (1u << 31) || d.y >= (1u << 31))
+            throw runtime_error("detection too far out to group.");
+
+    _groups.clear();
+    _build_grid(ds);
+    if (_params.method == GROUP_NMS)
+        _group_nms(ds);
+    else _group_neighbors(ds);
+    _finish();
+    return _sorted;
+}
+
+// Octave of a size: detections of octave l are smaller than 2 << l, the cell
+// size of their grid.
+static unsigned _octave(double size) {
+    uint32_t v = (size < 1.0) ? 1 : (size > UINT16_MAX) ? UINT16_MAX : (uint32_t) size;
+    return 31 - __builtin_clz(v);
+}
+
+static const unsigned OCTAVES = 16;
+
+static uint64_t _cell_key(unsigned level, uint64_t cy, uint64_t cx) {
+    return ((uint64_t) level << 60) | (cy << 30) | cx;
+}
+
+void detection_grouper::_build_grid(const vector<detection>& ds) {
+    _grid.resize(ds.size());
+    for (uint32_t i = 0; i < ds.size(); ++i) {
+        unsigned level = _octave(max(ds[i].w, ds[i].h));
+        _grid[i] = make_pair(_cell_key(level, ds[i].y >> (level + 1), ds[i].x >> (level + 1)), i);
+    }
+    sort(_grid.begin(), _grid.end());
+
+    _levelMax.assign(OCTAVES, detection{0, 0, 0, 0, 0});
+    for (auto& d : ds) {
+        detection& m = _levelMax[_octave(max(d.w, d.h))];
+        m.w = max(m.w, d.w);
+        m.h = max(m.h, d.h);
+    }
+
+    _levelBegin.resize(OCTAVES + 1);
+    for (unsigned level = 0; level < OCTAVES; ++level)
+        _levelBegin[level] = lower_bound(_grid.begin(), _grid.end(), make_pair(_cell_key(level, 0, 0), (uint32_t) 0)) - _grid.begin();
+    _levelBegin[OCTAVES] = _grid.size();
+}
+
+// Calls f with (at least) every detection of the octave whose top left corner
+// is in [x0, x1] x [y0, y1]. When that covers more cells than the octave has
+// detections, the whole octave is walked instead.
+template<typename F>
+void detection_grouper::_query(unsigned level, double x0, double y0, double x1, double y1, F f) const {
+    size_t begin = _levelBegin[level], end = _levelBegin[level + 1];
+    if (begin == end || x1 < 0.0 || y1 < 0.0)
+        return;
+
+    double cell = (double) (2u << level);
+    const uint64_t lastCell = (1u << 30) - 1;
+    uint64_t cx0 = (uint64_t) (max(x0, 0.0) / cell), cx1 = min(lastCell, (uint64_t) (x1 / cell));
+    uint64_t cy0 = (uint64_t) (max(y0, 0.0) / cell), cy1 = min(lastCell, (uint64_t) (y1 / cell));
+    if ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > end - begin) {
+        for (size_t k = begin; k < end; ++k)
+            f(_grid[k].second);
+        return;
+    }
+
+    // cells of a row are consecutive in key order
+    for (uint64_t cy = cy0; cy <= cy1; ++cy) {
+        uint64_t last = _cell_key(level, cy, cx1);
+        auto it = lower_bound(_grid.begin() + begin, _grid.begin() + end, make_pair(_cell_key(level, cy, cx0), (uint32_t) 0));
+        for (; it != _grid.begin() + end && it->first <= last; ++it)
+            f(it->second);
+    }
+}
+
+uint32_t detection_grouper::_find(uint32_t i) {
+    while (_parent[i] != i) {
+        _parent[i] = _parent[_parent[i]];
+        i = _parent[i];
+    }
+    return i;
+}
+
+// Same similarity test as OpenCV's groupRectangles. Similar detections have
+// corners within similarity * (w + h) / 2 of each other and sizes within
+// twice that, which bounds the cells and octaves to look at.
+void detection_grouper::_group_neighbors(const vector<detection>& ds) {
+    uint32_t n = (uint32_t) ds.size();
+    double eps = _params.similarity;
+
+    _parent.resize(n);
+    iota(_parent.begin(), _parent.end(), 0);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const detection& di = ds[i];
+        double reach = eps * (di.w + di.h) * 0.5;
+        double size = max(di.w, di.h);
+        auto similar = [&](uint32_t j) {
+            if (j <= i)
+                return;
+            const detection& dj = ds[j];
+            double delta = eps * (min(di.w, dj.w) + min(di.h, dj.h)) * 0.5;
+            if (fabs((double) di.x - dj.x) <= delta &&
+                    fabs((double) di.y - dj.y) <= delta &&
+                    fabs((double) (di.x + di.w) - (dj.x + dj.w)) <= delta &&
+                    fabs((double) (di.y + di.h) - (dj.y + dj.h)) <= delta) {
+                // the smallest index is the root, so groups come out in input order
+                uint32_t ri = _find(i), rj = _find(j);
+                if (ri < rj)
+                    _parent[rj] = ri;
+                else if (rj < ri)
+                    _parent[ri] = rj;
+            }
+        };
+        for (unsigned level = _octave(size - 2 * reach); level <= _octave(size + 2 * reach); ++level)
+            _query(level, di.x - reach, di.y - reach, di.x + reach, di.y + reach, similar);
+    }
+
+    _sums.assign(n * 4, 0.0);
+    _counts.assign(n, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t r = _find(i);
+        _sums[r * 4] += ds[i].x;
+        _sums[r * 4 + 1] += ds[i].y;
+        _sums[r * 4 + 2] += ds[i].w;
+        _sums[r * 4 + 3] += ds[i].h;
+        ++_counts[r];
+    }
+
+    _rootOf.assign(n, NONE);
+    for (uint32_t r = 0; r < n; ++r) {
+        if (_parent[r] != r || _counts[r] < _params.minNeighbors)
+            continue;
+        double c = _counts[r];
+        detection rect{(uint32_t) lround(_sums[r * 4] / c),
+            (uint32_t) lround(_sums[r * 4 + 1] / c),
+            (uint16_t) lround(_sums[r * 4 + 2] / c),
+            (uint16_t) lround(_sums[r * 4 + 3] / c),
+            ds[r].cascade};
+        _rootOf[r] = (uint32_t) _groups.size();
+        _groups.push_back(detection_group{rect, _counts[r], 0.0});
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t g = _rootOf[_find(i)];
+        if (g != NONE)
+            _groups[g].confidence += detection_iou(ds[i], _groups[g].rect);
+    }
+}
+
+// Calls f with every other detection that overlaps ds[i] by at least the
+// overlap IoU. Those are at most 1 / overlap times as wide and high and at
+// least overlap times its area, which bounds the octaves. They also share at
+// least overlap of the width of both, so a detection of width w to the left
+// starts at most (1 - overlap) * w before it, one to the right at most
+// (1 - overlap) * di.w after it, and the same vertically.
+template<typename F>
+void detection_grouper::_overlapping(const vector<detection>& ds, uint32_t i, F f) const {
+    const detection& di = ds[i];
+    double overlap = _params.overlap;
+    unsigned first = _octave(sqrt(overlap * di.w * di.h));
+    unsigned last = _octave(max(di.w, di.h) / overlap);
+
+    for (unsigned level = first; level <= last && level < OCTAVES; ++level) {
+        double left = (1.0 - overlap) * _levelMax[level].w, up = (1.0 - overlap) * _levelMax[level].h;
+        double right = (1.0 - overlap) * di.w, down = (1.0 - overlap) * di.h;
+        _query(level, di.x - left, di.y - up, di.x + right, di.y + down, [&](uint32_t j) {
+            if (j != i && detection_iou(di, ds[j]) >= overlap)
+                f(j);
+        });
+    }
+}
+
+// Greedy NMS, ranked by support (one plus the number of neighbours
+// overlapping by at least overlap) since raw detections carry no score.
+// Every detection joins the best ranked kept detection it overlaps, the ones
+// that overlap none are kept.
+void detection_grouper::_group_nms(const vector<detection>& ds) {
+    uint32_t n = (uint32_t) ds.size();
+
+    _support.assign(n, 1);
+    for (uint32_t i = 0; i < n; ++i)
+        _overlapping(ds, i, [&](uint32_t) {
+            ++_support[i];
+        });
+
+    // best supported first, ties in input order
+    _order.resize(n);
+    iota(_order.begin(), _order.end(), 0);
+    sort(_order.begin(), _order.end(), [this](uint32_t a, uint32_t b) {
+        return (_support[a] != _support[b]) ? _support[a] > _support[b] : a < b;
+    });
+    _rank.resize(n);
+    for (uint32_t k = 0; k < n; ++k)
+        _rank[_order[k]] = k;
+
+    _parent.assign(n, NONE);
+    for (auto i : _order) {
+        uint32_t best = i;
+        _overlapping(ds, i, [&](uint32_t j) {
+            if (_parent[j] == j && _rank[j] < _rank[best])
+                best = j;
+        });
+        _parent[i] = best;
+    }
+
+    _counts.assign(n, 0);
+    for (uint32_t i = 0; i < n; ++i)
+        ++_counts[_parent[i]];
+
+    _rootOf.assign(n, NONE);
+    for (uint32_t k = 0; k < n; ++k) {
+        if (_parent[k] != k || _counts[k] < _params.minNeighbors)
+            continue;
+        _rootOf[k] = (uint32_t) _groups.size();
+        _groups.push_back(detection_group{ds[k], _counts[k], 0.0});
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t g = _rootOf[_parent[i]];
+        if (g != NONE)
+            _groups[g].confidence += detection_iou(ds[i], _groups[g].rect);
+    }
+}
+
+// _groups is in input order, sort it by confidence into _sorted.
+void detection_grouper::_finish() {
+    _ranking.resize(_groups.size());
+    iota(_ranking.begin(), _ranking.end(), 0);
+    sort(_ranking.begin(), _ranking.end(), [this](uint32_t a, uint32_t b) {
+        return (_groups[a].confidence != _groups[b].confidence) ? _groups[a].confidence > _groups[b].confidence : a < b;
+    });
+
+    _sorted.clear();
+    for (auto g : _ranking)
+        _sorted.push_back(_groups[g]);
+}
+
+vector<detection_group> group_detections(const vector<detection>& ds, const group_params& params) {
+    detection_grouper grouper(params);
+    return grouper.group(ds);
+}
@@ -0,0 +1,101 @@
+
+#ifndef __grouping_h
+#define __grouping_h
+
+#include "detector.h"
+#include <vector>
+
+enum group_method {
+    // OpenCV style grouping: detections whose corners are all within
+    // similarity times their size of each other are clustered (transitively)
+    // and every cluster is averaged into one rectangle.
+    GROUP_NEIGHBORS,
+    // Greedy non-maximum suppression: the detection with the most neighbours
+    // (other detections overlapping it by at least overlap IoU) is kept and
+    // absorbs its neighbours, then the next one left, and so on.
+    GROUP_NMS
+};
+
+struct group_params {
+    group_method method = GROUP_NEIGHBORS;
+    // Groups made of fewer raw detections are dropped.
+    size_t minNeighbors = 3;
+    // GROUP_NEIGHBORS: allowed corner offset relative to the window size.
+    double similarity = 0.2;
+    // GROUP_NMS: intersection over union at which detections are merged.
+    double overlap = 0.3;
+};
+
+// Groups merge the detections of every cascade (see detector), rect.cascade
+// is that of one of the merged detections: the one kept under GROUP_NMS, the
+// first of the cluster under GROUP_NEIGHBORS. Group each cascade's detections
+// on their own to keep them apart.
+struct detection_group {
+    detection rect;
+    // Raw detections merged into the group.
+    size_t neighbors;
+    // Sum of the IoU of every merged detection with rect: how many raw
+    // detections agree on the group, weighted by how well they agree.
+    double confidence;
+};
+
+// Reusable grouping context, like detector: its buffers are sized on the
+// first call and reused. Detections are hashed into a grid per size octave
+// (cells a bit larger than the detections in them), kept as one sorted array
+// of cell keys, and only detections in cells within reach of each other are
+// compared. Grouping takes O(n log n) plus the pairs that really are close,
+// rather than O(n^2). Groups are returned by decreasing confidence, ties in
+// input order, so the result only depends on the input.
+class detection_grouper {
+public:
+    detection_grouper(const group_params& params = group_params());
+    ~detection_grouper() noexcept;
+
+    // The result stays valid until the next call.
+    const std::vector<detection_group>& group(const std::vector<detection>& ds);
+
+private:
+    void _build_grid(const std::vector<detection>& ds);
+    template<typename F>
+    void _query(unsigned level, double x0, double y0, double x1, double y1, F f) const;
+    template<typename F>
+    void _overlapping(const std::vector<detection>& ds, uint32_t i, F f) const;
+    void _group_neighbors(const std::vector<detection>& ds);
+    void _group_nms(const std::vector<detection>& ds);
+    uint32_t _find(uint32_t i);
+    void _finish();
+
+    group_params _params;
+    // (octave, cell row, cell column) key and index of every detection,
+    // sorted, where each octave starts in it and the largest width and
+    // height in each octave
+    std::vector<std::pair<uint64_t, uint32_t>> _grid;
+    std::vector<size_t> _levelBegin;
+    std::vector<detection> _levelMax;
+    // union-find forest (GROUP_NEIGHBORS), or the detection each one was
+    // merged into (GROUP_NMS)
+    std::vector<uint32_t> _parent;
+    // GROUP_NMS: neighbours of each detection, detections by support, and
+    // where each one is in that order
+    std::vector<uint32_t> _support;
+    std::vector<uint32_t> _order;
+    std::vector<uint32_t> _rank;
+    // per detection accumulators, indexed by the group's root, and the
+    // group each root became
+    std::vector<double> _sums;
+    std::vector<uint32_t> _counts;
+    std::vector<uint32_t> _rootOf;
+    // groups in input order, and by confidence
+    std::vector<detection_group> _groups;
+    std::vector<uint32_t> _ranking;
+    std::vector<detection_group> _sorted;
+};
+
+// Intersection over union of two rectangles.
+double detection_iou(const detection& a, const detection& b);
+
+// One-shot grouping with a temporary grouper.
+std::vector<detection_group> group_detections(const std::vector<detection>& ds,
+        const group_params& params = group_params());
+
+#endif
@@ -13,14 +13,9 @@
 
 using namespace std;
 
+// Only the integral images of a sample are kept; everything else is a per
+// sample temporary that goes back to the pools in load_dataset.
 struct image_resources {
-    image<uint32_t> img;
-    uint16_t sw;
-    uint16_t sh;
-    image<uint32_t> scaled;
-    image<uint32_t> cropped;
-    image<double> lum;
-    image<double> normalized;
     image<double> integral;
     image<double> mirror;
 };
@@ -36,48 +31,56 @@ void load_dataset(const string& path,
         {"/negative", negative}
     };
 
+    image_pool<uint32_t> argbPool;
+    image_pool<double> lumPool;
+
     for (auto& s : sources) {
         auto ppmPaths = get_ppm_file_paths(path + s.first);
 
         for (auto& p : ppmPaths) {
             image_resources ir;
-            ir.img = image_create_from_ppm(p);
+            auto img = image_create_from_ppm(p);
+            uint16_t sw, sh;
 
-            double imgAR = (double) ir.img.w / (double) ir.img.h;
+            double imgAR = (double) img.w / (double) img.h;
 
             // image is wider than tall
             if (imgAR > 1.0) {
-                ir.sw = baseResolution;
-                ir.sh = (uint16_t) (baseResolution / imgAR);
+                sw = baseResolution;
+                sh = (uint16_t) (baseResolution / imgAR);
             } else // image is taller than wide
             {
-                ir.sw = (uint16_t) (baseResolution * imgAR);
-                ir.sh = baseResolution;
+                sw = (uint16_t) (baseResolution * imgAR);
+                sh = baseResolution;
             }
 
-            ir.scaled = image_resize(ir.img, ir.sw, ir.sh);
-
-            ir.cropped = image_create<uint32_t>(baseResolution, baseResolution);
+            auto cropped = image_create<uint32_t>(baseResolution, baseResolution, 0, &argbPool);
+            fill(cropped.bits.begin(), cropped.bits.end(), 0);
 
+            // resize straight into the letterboxed region of cropped
             if (imgAR > 1.0) {
-                uint16_t heightDelta = baseResolution - ir.sh;
-                image_blit<uint32_t>(ir.scaled, 0, 0, ir.sw, ir.sh, ir.cropped, 0, heightDelta / 2);
+                uint16_t heightDelta = baseResolution - sh;
+                image_resize(image_view<const uint32_t>(img), image_roi(cropped, 0, heightDelta / 2, sw, sh));
             } else {
-                uint16_t widthDelta = baseResolution - ir.sw;
-                image_blit<uint32_t>(ir.scaled, 0, 0, ir.sw, ir.sh, ir.cropped, widthDelta / 2, 0);
+                uint16_t widthDelta = baseResolution - sw;
+                image_resize(image_view<const uint32_t>(img), image_roi(cropped, widthDelta / 2, 0, sw, sh));
             }
 
-            ir.lum = image_argb_to_lum<double>(ir.cropped);
-            ir.normalized = image_normalize(ir.lum);
-            ir.integral = image_integral(ir.normalized);
+            auto lum = image_argb_to_lum<double>(cropped, &lumPool);
+            auto normalized = image_normalize(lum, &lumPool);
+            ir.integral = image_integral(normalized);
             ir.mirror = image_mirror_vertical(ir.integral);
-            s.second.push_back(ir);
+            s.second.push_back(std::move(ir));
+
+            argbPool.release(std::move(cropped));
+            lumPool.release(std::move(lum));
+            lumPool.release(std::move(normalized));
         }
     }
 }
 
-vector<image<double>> slice_dataset_integral(const vector<image_resources>& resources) {
-    vector<image<double>> images;
+vector<image_view<const double>> slice_dataset_integral(const vector<image_resources>& resources) {
+    vector<image_view<const double>> images;
     for (auto& r : resources) {
         images.push_back(r.integral);
         images.push_back(r.mirror);
@@ -85,11 +88,17 @@ vector<image<double>> slice_dataset_integral(const vector<image_resources>& reso
     return images;
 }
 
+// Optional soft cascade training, both off by default: SOFT_CASCADE calibrates
+// per weak classifier rejection traces for every stage, CARRY_SCORE starts
+// every stage from the score the stage before it ended with.
+const bool SOFT_CASCADE = false;
+const bool CARRY_SCORE = false;
+
 strong_classifier adaboost_learning(cascade_classifier& cc,
         const vector<feature>& features,
-        const vector<image<double>>&trainPositive,
-        const vector<image<double>>&trainNegative,
-        const vector<image<double>>&validation,
+        const vector<image_view<const double>>&trainPositive,
+        const vector<image_view<const double>>&trainNegative,
+        const vector<image_view<const double>>&validation,
         double minfpr,
         double maxfnr,
         uint16_t baseResolution) {
@@ -106,6 +115,10 @@ strong_classifier adaboost_learning(cascade_classifier& cc,
 
     strong_classifier sc;
 
+    // with carried scores the new stage starts from where the cascade left
+    // each positive
+    vector<double> startScores = cc.scores(trainPositive);
+
     double cfpr = 1.0;
     vector<double> fvalues(trainPositiveSize + trainNegativeSize);
     while (cfpr > minfpr) {
@@ -157,7 +170,9 @@ strong_classifier adaboost_learning(cascade_classifier& cc,
                 weights[trainPositiveSize + i] *= betat;
 
         sc.add(bestwc, log(1.0 / betat));
-        sc.optimize_threshold(trainPositive, maxfnr);
+        sc.optimize_threshold(trainPositive, maxfnr, startScores);
+        if (SOFT_CASCADE)
+            sc.calibrate_rejection(trainPositive, startScores);
 
         cc.push_back(sc);
         cfpr = cc.fpr(validation);
@@ -204,6 +219,7 @@ int main(int argc, char* argv[]) {
     printf("Boosting...\n");
 
     cascade_classifier cc(BASE_RES_W);
+    cc.set_carry_score(CARRY_SCORE);
 
     auto trainPositiveIntegrals = slice_dataset_integral(trainPositive);
     auto trainNegativeIntegrals = slice_dataset_integral(trainNegative);
@@ -224,8 +240,8 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        vector<image<double>> misclassifiedNegativeIntegrals;
-        for (auto ni : trainNegativeIntegrals)
+        vector<image_view<const double>> misclassifiedNegativeIntegrals;
+        for (auto& ni : trainNegativeIntegrals)
             if (cc.classify(ni, 0, 0, 0.0, 1.0) == true)
                 misclassifiedNegativeIntegrals.push_back(ni);
 
@@ -245,9 +261,16 @@ int main(int argc, char* argv[]) {
 
         cc.push_back(sc);
 
+        // a stage that carries the score can only be evaluated after the
+        // stages before it, so with CARRY_SCORE the whole cascade decides
+        auto accepted = [&](const image_view<const double>& img) {
+            return CARRY_SCORE ? cc.classify(img, 0, 0, 0.0, 1.0)
+                               : sc.classify(img, 0, 0, 0.0, 1.0);
+        };
+
         size_t fdel = 0, nfdel = 0;
         for (size_t n = 0; n < trainNegativeIntegrals.size(); ++n) {
-            if (sc.classify(trainNegativeIntegrals[n], 0, 0, 0.0, 1.0) == false) {
+            if (accepted(trainNegativeIntegrals[n]) == false) {
                 trainNegativeIntegrals.erase(trainNegativeIntegrals.begin() + n);
                 n--;
                 nfdel++;
@@ -255,7 +278,7 @@ int main(int argc, char* argv[]) {
         }
 
         for (size_t n = 0; n < trainPositiveIntegrals.size(); n++) {
-            if (sc.classify(trainPositiveIntegrals[n], 0, 0, 0.0, 1.0) == false) {
+            if (accepted(trainPositiveIntegrals[n]) == false) {
                 trainPositiveIntegrals.erase(trainPositiveIntegrals.begin() + n);
                 n--;
                 fdel++;
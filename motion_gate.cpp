@@ -0,0 +1,97 @@
+
+#include "motion_gate.h"
+#include <cmath>
+
+using namespace std;
+
+motion_gate::motion_gate(const motion_params& params) :
+_params(params),
+_blocks(),
+_reference(),
+_mask(),
+_integral(),
+_hasReference(false),
+_moving(1.0),
+_gate(),
+_allocations(0) {
+    if (params.cell == 0)
+        throw runtime_error("motion_gate cell must be at least 1.");
+    if (params.backgroundRate < 0.0 || params.backgroundRate > 1.0)
+        throw runtime_error("motion_gate backgroundRate must be in [0, 1].");
+}
+
+motion_gate::~motion_gate() noexcept {
+}
+
+void motion_gate::reset() {
+    _hasReference = false;
+}
+
+// Mean of every cell x cell block of lum into _blocks, blocks on the right and
+// bottom border average the pixels they have.
+void motion_gate::_reduce(const image_view<const double>& lum) {
+    uint16_t cell = _params.cell;
+    image_view<double> blocks(_blocks);
+    for (uint16_t by = 0; by < _blocks.h; ++by) {
+        double* out = blocks.row(by);
+        fill(out, out + _blocks.w, 0.0);
+
+        uint16_t y0 = by * cell, y1 = (uint16_t) min((uint32_t) lum.h, (uint32_t) y0 + cell);
+        for (uint16_t y = y0; y < y1; ++y) {
+            const double* row = lum.row(y);
+            for (uint16_t bx = 0; bx < _blocks.w; ++bx) {
+                uint16_t x0 = bx * cell, x1 = (uint16_t) min((uint32_t) lum.w, (uint32_t) x0 + cell);
+                double s = 0.0;
+                for (uint16_t x = x0; x < x1; ++x)
+                    s += row[x];
+                out[bx] += s;
+            }
+        }
+
+        for (uint16_t bx = 0; bx < _blocks.w; ++bx) {
+            uint32_t pw = min((uint32_t) lum.w, (uint32_t) bx * cell + cell) - bx * cell;
+            out[bx] /= (double) pw * (y1 - y0);
+        }
+    }
+}
+
+const window_gate& motion_gate::update(const image_view<const double>& lum) {
+    uint16_t bw = (uint16_t) ((lum.w + _params.cell - 1) / _params.cell);
+    uint16_t bh = (uint16_t) ((lum.h + _params.cell - 1) / _params.cell);
+    if (_blocks.w != bw || _blocks.h != bh) {
+        _blocks = image_create_padded<double>(bw, bh);
+        _reference = image_create_padded<double>(bw, bh);
+        _mask = image_create_padded<double>(bw, bh);
+        _integral = image_create_padded<double>(bw, bh);
+        _allocations += 4;
+        _hasReference = false;
+    }
+
+    _reduce(lum);
+
+    size_t moving = 0;
+    double rate = _params.backgroundRate;
+    image_view<const double> blocks(_blocks);
+    image_view<double> reference(_reference), mask(_mask);
+    for (uint16_t y = 0; y < bh; ++y) {
+        const double* b = blocks.row(y);
+        double* ref = reference.row(y);
+        double* m = mask.row(y);
+        for (uint16_t x = 0; x < bw; ++x) {
+            bool moved = !_hasReference || fabs(b[x] - ref[x]) > _params.threshold;
+            m[x] = moved ? 1.0 : 0.0;
+            moving += moved;
+            ref[x] = (_hasReference && rate > 0.0) ? ref[x] + rate * (b[x] - ref[x]) : b[x];
+        }
+    }
+    _hasReference = true;
+    _moving = (double) moving / ((size_t) bw * bh);
+
+    image_integral(image_view<const double>(_mask), image_view<double>(_integral));
+    _gate.mask = _integral;
+    _gate.x = lum.x;
+    _gate.y = lum.y;
+    _gate.cell = _params.cell;
+    _gate.minFraction = _params.minFraction;
+    return _gate;
+}
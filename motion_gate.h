@@ -0,0 +1,72 @@
+
+#ifndef __motion_gate_h
+#define __motion_gate_h
+
+#include "detector.h"
+
+struct motion_params {
+    // Side of the pixel blocks motion is measured on.
+    uint16_t cell = 8;
+    // A block moves when its mean luminance differs from the reference by
+    // more than this.
+    double threshold = 8.0;
+    // 0 compares every frame with the one before it. Otherwise the reference
+    // is a running background, pulled towards every frame by this fraction.
+    double backgroundRate = 0.0;
+    // Fraction of the blocks under a window that have to move for the window
+    // to be scanned, see window_gate.
+    double minFraction = 0.1;
+};
+
+// Motion pre-stage for fixed cameras. Every frame is reduced to the mean
+// luminance of its cell x cell blocks and compared with the previous frame's
+// (or a running background); blocks that changed by more than threshold make
+// up the motion mask, whose integral gates the detector:
+//
+//     detector d(cc);
+//     motion_gate motion;
+//     for (auto& lum : frames)
+//         auto& ds = d.detect(lum, motion.update(lum));
+//
+// so windows over static parts of the scene never reach the cascade. The
+// first frame, and the first after a change of frame size, has no reference
+// and is open everywhere. The buffers are sized on first use like the
+// detector's, allocations() counts every time they had to be (re)allocated.
+class motion_gate {
+public:
+    motion_gate(const motion_params& params = motion_params());
+    ~motion_gate() noexcept;
+
+    // Measure the motion in lum against the reference and move the reference
+    // on. The gate stays valid until the next call.
+    const window_gate& update(const image_view<const double>& lum);
+
+    // Forget the reference, the next frame is open everywhere.
+    void reset();
+
+    // Fraction of the blocks of the last frame that moved.
+    double moving() const {
+        return _moving;
+    }
+
+    size_t allocations() const {
+        return _allocations;
+    }
+
+private:
+    void _reduce(const image_view<const double>& lum);
+
+    motion_params _params;
+    // block means of the frame, the reference they are compared with, the
+    // mask and its integral
+    image<double> _blocks;
+    image<double> _reference;
+    image<double> _mask;
+    image<double> _integral;
+    bool _hasReference;
+    double _moving;
+    window_gate _gate;
+    size_t _allocations;
+};
+
+#endif
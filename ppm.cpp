@@ -1,6 +1,11 @@
 
 #include "ppm.h"
+#include "utils.h"
 #include <stdlib.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -41,9 +46,10 @@ image<uint32_t> image_create_from_ppm(const std::string& fileName) {
         if (colorMax > 255)
             throw runtime_error("ppm support limited to 24 bit rgb.");
 
-        img.bits = make_shared<vector < uint32_t >> (img.w * img.h);
+        img.bits.resize(img.w * img.h);
+        img.stride = img.w;
 
-        uint32_t* begin = &img.bits->at(0);
+        uint32_t* begin = img.bits.data();
         uint32_t* dst = begin;
 
         while (!feof(inFile) && ((dst - begin) < (img.w * img.h))) {
@@ -101,17 +107,16 @@ void image_write_ppm(const image<uint32_t>& img, const string& fileName) {
         fprintf(outFile, "%d %d\n", (int) img.w, (int) img.h);
         fprintf(outFile, "255\n");
 
-        auto src = &img.bits->at(0);
-
-        size_t numPixels = img.bits->size();
+        for (uint16_t y = 0; y < img.h; ++y) {
+            auto src = img.bits.data() + (y * img.stride);
 
-        while (numPixels > 0) {
-            // src is B G R A, ppm is R G B
-            fwrite(((uint8_t*) src) + 2, 1, 1, outFile);
-            fwrite(((uint8_t*) src) + 1, 1, 1, outFile);
-            fwrite(((uint8_t*) src) + 0, 1, 1, outFile);
-            ++src;
-            --numPixels;
+            for (uint16_t x = 0; x < img.w; ++x) {
+                // src is B G R A, ppm is R G B
+                fwrite(((uint8_t*) src) + 2, 1, 1, outFile);
+                fwrite(((uint8_t*) src) + 1, 1, 1, outFile);
+                fwrite(((uint8_t*) src) + 0, 1, 1, outFile);
+                ++src;
+            }
         }
 
         fclose(outFile);
@@ -122,6 +127,179 @@ void image_write_ppm(const image<uint32_t>& img, const string& fileName) {
     }
 }
 
+// image_resize_argb samples at the same positions as the original float
+// implementation but blends in 7 bit fixed point: every channel is
+// (top * (128 - yw) + bottom * yw + 8192) >> 14 where top and bottom are the
+// horizontally blended rows. The SIMD kernels do the exact same integer math
+// so every path produces identical pixels.
+
+struct _resize_taps {
+    vector<uint16_t> offset; // left / top source sample, always leaves room for the +1 neighbour
+    vector<uint16_t> weight; // weight of the +1 neighbour, 0..128
+};
+
+static _resize_taps _image_resize_taps(uint16_t inSize, uint16_t outSize) {
+    _resize_taps taps;
+    taps.offset.resize(outSize);
+    taps.weight.resize(outSize);
+
+    float ratio = ((float) (inSize - 1)) / outSize;
+    int last = max(0, inSize - 2);
+
+    for (uint16_t i = 0; i < outSize; ++i) {
+        float pos = ratio * i;
+        int o = min((int) pos, last);
+        float diff = min(max(pos - o, 0.0f), 1.0f);
+        taps.offset[i] = (uint16_t) o;
+        taps.weight[i] = (inSize > 1) ? (uint16_t) lround(diff * 128) : 0;
+    }
+
+    return taps;
+}
+
+static inline uint32_t _resize_blend(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t xw, uint32_t yw) {
+    uint32_t out = 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t top = ((a >> shift) & 0xff) * (128 - xw) + ((b >> shift) & 0xff) * xw;
+        uint32_t bottom = ((c >> shift) & 0xff) * (128 - xw) + ((d >> shift) & 0xff) * xw;
+        out |= ((top * (128 - yw) + bottom * yw + 8192) >> 14) << shift;
+    }
+    return out;
+}
+
+static void _image_resize_row_scalar(const uint32_t* top, const uint32_t* bottom, uint32_t yw, const _resize_taps& xt,
+        uint16_t from, uint16_t step, uint32_t* dst, uint16_t count) {
+    for (uint16_t j = from; j < count; ++j) {
+        uint16_t x = xt.offset[j];
+        uint16_t x1 = x + step;
+        dst[j] = _resize_blend(top[x], top[x1], bottom[x], bottom[x1], xt.weight[j], yw);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Horizontal pass for two output pixels: returns the blended top row as
+// eight 16 bit values (B G R A of pixel j, then pixel j + 1).
+static inline __m128i _resize_pair_sse2(const uint32_t* row, uint16_t x0, uint16_t x1, __m128i w0, __m128i w1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i p0 = _mm_loadl_epi64((const __m128i*) (row + x0));
+    __m128i p1 = _mm_loadl_epi64((const __m128i*) (row + x1));
+    // interleave the left and right neighbour channel by channel: a.b b.b a.g b.g ...
+    p0 = _mm_unpacklo_epi8(p0, _mm_srli_si128(p0, 4));
+    p1 = _mm_unpacklo_epi8(p1, _mm_srli_si128(p1, 4));
+    __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi8(p0, zero), w0);
+    __m128i s1 = _mm_madd_epi16(_mm_unpacklo_epi8(p1, zero), w1);
+    return _mm_packs_epi32(s0, s1);
+}
+
+static void _image_resize_row_sse2(const uint32_t* top, const uint32_t* bottom, uint32_t yw, const _resize_taps& xt,
+        const vector<int32_t>& xWeights, uint32_t* dst, uint16_t count) {
+    const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+    const __m128i round = _mm_set1_epi32(8192);
+    const __m128i wy = _mm_set1_epi32((int) ((yw << 16) | (128 - yw)));
+
+    uint16_t j = 0;
+    for (; j + 2 <= count; j += 2) {
+        __m128i w0 = _mm_set1_epi32(xWeights[j]);
+        __m128i w1 = _mm_set1_epi32(xWeights[j + 1]);
+        __m128i t = _resize_pair_sse2(top, xt.offset[j], xt.offset[j + 1], w0, w1);
+        __m128i b = _resize_pair_sse2(bottom, xt.offset[j], xt.offset[j + 1], w0, w1);
+        __m128i v0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t, b), wy), round), 14);
+        __m128i v1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t, b), wy), round), 14);
+        __m128i v = _mm_packs_epi32(v0, v1);
+        v = _mm_or_si128(_mm_packus_epi16(v, v), alpha);
+        _mm_storel_epi64((__m128i*) (dst + j), v);
+    }
+
+    _image_resize_row_scalar(top, bottom, yw, xt, j, 1, dst, count);
+}
+
+static inline __m128i _resize_load_pairs(const uint32_t* row, uint16_t x0, uint16_t x1) {
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) (row + x0)), _mm_loadl_epi64((const __m128i*) (row + x1)));
+}
+
+// Four output pixels per iteration, lanes hold pixels (j, j + 1) and
+// (j + 2, j + 3). Neighbour pairs are plain 64 bit loads, hardware gathers
+// are slower here.
+__attribute__((target("avx2")))
+static inline __m256i _resize_quad_avx2(const uint32_t* row, const uint16_t* offsets, __m256i wLo, __m256i wHi) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i interleave = _mm256_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15,
+            0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    __m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(_resize_load_pairs(row, offsets[0], offsets[1])),
+            _resize_load_pairs(row, offsets[2], offsets[3]), 1);
+    p = _mm256_shuffle_epi8(p, interleave);
+    __m256i sLo = _mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), wLo);
+    __m256i sHi = _mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), wHi);
+    return _mm256_packs_epi32(sLo, sHi);
+}
+
+__attribute__((target("avx2")))
+static void _image_resize_row_avx2(const uint32_t* top, const uint32_t* bottom, uint32_t yw, const _resize_taps& xt,
+        const vector<int32_t>& xWeights, uint32_t* dst, uint16_t count) {
+    const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+    const __m256i round = _mm256_set1_epi32(8192);
+    const __m256i wy = _mm256_set1_epi32((int) ((yw << 16) | (128 - yw)));
+    const __m256i evens = _mm256_setr_epi32(0, 0, 0, 0, 2, 2, 2, 2);
+    const __m256i odds = _mm256_setr_epi32(1, 1, 1, 1, 3, 3, 3, 3);
+
+    uint16_t j = 0;
+    for (; j + 4 <= count; j += 4) {
+        const uint16_t* offsets = xt.offset.data() + j;
+        __m256i w = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (xWeights.data() + j)));
+        __m256i wLo = _mm256_permutevar8x32_epi32(w, evens);
+        __m256i wHi = _mm256_permutevar8x32_epi32(w, odds);
+        __m256i t = _resize_quad_avx2(top, offsets, wLo, wHi);
+        __m256i b = _resize_quad_avx2(bottom, offsets, wLo, wHi);
+        __m256i vLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(t, b), wy), round), 14);
+        __m256i vHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(t, b), wy), round), 14);
+        __m256i v = _mm256_packs_epi32(vLo, vHi);
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128((__m128i*) (dst + j), _mm_or_si128(_mm256_castsi256_si128(v), alpha));
+    }
+
+    _image_resize_row_scalar(top, bottom, yw, xt, j, 1, dst, count);
+}
+
+#endif
+
+void image_resize_argb(const image_view<const uint32_t>& input, const image_view<uint32_t>& output) {
+    if (output.w == 0 || output.h == 0)
+        return;
+    if (input.w == 0 || input.h == 0)
+        throw runtime_error("geometry exception (empty resize input)");
+
+    _resize_taps xt = _image_resize_taps(input.w, output.w);
+    _resize_taps yt = _image_resize_taps(input.h, output.h);
+
+    // single column / row inputs have no +1 neighbour, blend the sample with itself
+    uint16_t xStep = (input.w > 1) ? 1 : 0;
+    size_t yStep = (input.h > 1) ? input.stride : 0;
+    simd_level simd = (xStep != 0) ? simd_supported() : SIMD_NONE;
+
+    vector<int32_t> xWeights;
+    if (simd >= SIMD_SSE2) {
+        xWeights.resize(output.w);
+        for (uint16_t j = 0; j < output.w; ++j)
+            xWeights[j] = (int32_t) ((xt.weight[j] << 16) | (128 - xt.weight[j]));
+    }
+
+    for (uint16_t i = 0; i < output.h; ++i) {
+        const uint32_t* top = input.row(yt.offset[i]);
+        const uint32_t* bottom = top + yStep;
+        uint32_t* dst = output.row(i);
+
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd >= SIMD_AVX2)
+            _image_resize_row_avx2(top, bottom, yt.weight[i], xt, xWeights, dst, output.w);
+        else if (simd >= SIMD_SSE2)
+            _image_resize_row_sse2(top, bottom, yt.weight[i], xt, xWeights, dst, output.w);
+        else
+#endif
+            _image_resize_row_scalar(top, bottom, yt.weight[i], xt, 0, xStep, dst, output.w);
+    }
+}
+
 void aspect_correct_dimensions(uint16_t streamWidth, uint16_t streamHeight,
         uint16_t requestedWidth, uint16_t requestedHeight,
         uint16_t& destWidth, uint16_t& destHeight) {
@@ -2,6 +2,7 @@
 #define __ppm_h
 
 #include "zip.h"
+#include "aligned_allocator.h"
 #include <string>
 #include <memory>
 #include <vector>
@@ -11,30 +12,267 @@
 #include <stdexcept>
 #include <numeric>
 #include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+// Owning image. Images are move-only so that pixels are never shared or copied
+// by accident; pass an image_view (below) wherever a function only needs to
+// look at the pixels, and use image_copy() when a second copy is really wanted.
+//
+// Pixels are cache line aligned and rows are stride elements apart. stride is
+// w for packed images, padded images round each row up to a whole number of
+// cache lines so every row starts aligned.
 template<class T>
 struct image {
-    std::shared_ptr<std::vector<T>> bits;
+    std::vector<T, aligned_allocator<T>> bits;
+    uint16_t w;
+    uint16_t h;
+    size_t stride;
+
+    image() :
+    bits(),
+    w(0),
+    h(0),
+    stride(0) {
+    }
+
+    image(image&&) = default;
+    image& operator=(image&&) = default;
+
+    image(const image&) = delete;
+    image& operator=(const image&) = delete;
+};
+
+// Non-owning window onto pixels that live somewhere else (an image or a
+// caller's buffer). bits points at the first pixel of the view, stride is the
+// distance in elements between rows and x / y is the origin of the view inside
+// the image it was taken from.
+template<class T>
+struct image_view {
+    T* bits;
     uint16_t w;
     uint16_t h;
+    size_t stride;
+    uint16_t x;
+    uint16_t y;
+
+    image_view() :
+    bits(nullptr),
+    w(0),
+    h(0),
+    stride(0),
+    x(0),
+    y(0) {
+    }
+
+    image_view(T* bits, uint16_t w, uint16_t h, size_t stride, uint16_t x = 0, uint16_t y = 0) :
+    bits(bits),
+    w(w),
+    h(h),
+    stride(stride),
+    x(x),
+    y(y) {
+    }
+
+    template<class U, class = typename std::enable_if<std::is_same<U, typename std::remove_const<T>::type>::value>::type>
+    image_view(image<U>& img) :
+    bits(img.bits.data()),
+    w(img.w),
+    h(img.h),
+    stride(img.stride),
+    x(0),
+    y(0) {
+    }
+
+    template<class U, class = typename std::enable_if<std::is_same<const U, T>::value>::type>
+    image_view(const image<U>& img) :
+    bits(img.bits.data()),
+    w(img.w),
+    h(img.h),
+    stride(img.stride),
+    x(0),
+    y(0) {
+    }
+
+    template<class U, class = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+    image_view(const image_view<U>& v) :
+    bits(v.bits),
+    w(v.w),
+    h(v.h),
+    stride(v.stride),
+    x(v.x),
+    y(v.y) {
+    }
+
+    T* row(uint16_t r) const {
+        return bits + (r * stride);
+    }
+
+    T& at(uint16_t c, uint16_t r) const {
+        return bits[(r * stride) + c];
+    }
+};
+
+// Row stride (in elements) that makes every row of a w pixel wide image start
+// on a cache line.
+template<typename T>
+size_t image_padded_stride(uint16_t w) {
+    size_t rowBytes = ((w * sizeof(T)) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    return (rowBytes % sizeof(T) == 0) ? rowBytes / sizeof(T) : w;
+}
+
+// Size bucketed cache of pixel buffers for per-frame and per-sample
+// temporaries. Buffers are bucketed by power of two element count; create()
+// reuses a cached buffer from the matching bucket when there is one and
+// release() hands an image's buffer back. Once every size in use has been seen
+// once, create() does not allocate.
+//
+// Pixels of an image created from a pool are not cleared. Not thread safe, use
+// one pool per thread.
+template<typename T>
+class image_pool {
+public:
+    image_pool() :
+    _buckets(sizeof (size_t) * 8),
+    _allocations(0) {
+    }
+
+    image_pool(const image_pool&) = delete;
+    image_pool& operator=(const image_pool&) = delete;
+
+    image<T> create(uint16_t w, uint16_t h, size_t stride = 0) {
+        if (stride == 0)
+            stride = w;
+        if (stride < w)
+            throw std::runtime_error("geometry exception (stride < w)");
+
+        size_t n = stride * h;
+        auto& bucket = _buckets[_ceil_log2(n)];
+
+        image<T> img;
+        if (!bucket.empty()) {
+            img.bits = std::move(bucket.back());
+            bucket.pop_back();
+        } else {
+            img.bits.reserve(((size_t) 1) << _ceil_log2(n));
+            ++_allocations;
+        }
+        img.bits.resize(n);
+        img.w = w;
+        img.h = h;
+        img.stride = stride;
+        return img;
+    }
+
+    void release(image<T>&& img) {
+        if (img.bits.capacity() == 0)
+            return;
+        // capacity is at least 2^floor(log2(capacity)), enough for any request
+        // that maps to that bucket.
+        _buckets[_floor_log2(img.bits.capacity())].push_back(std::move(img.bits));
+        img.w = img.h = 0;
+        img.stride = 0;
+    }
+
+    // Number of buffers this pool has had to allocate.
+    size_t allocations() const {
+        return _allocations;
+    }
+
+    size_t cached() const {
+        size_t n = 0;
+        for (auto& b : _buckets)
+            n += b.size();
+        return n;
+    }
+
+    void clear() {
+        for (auto& b : _buckets)
+            b.clear();
+    }
+
+private:
+    static size_t _floor_log2(size_t n) {
+        size_t l = 0;
+        while (n >>= 1)
+            ++l;
+        return l;
+    }
+
+    static size_t _ceil_log2(size_t n) {
+        return (n <= 1) ? 0 : _floor_log2(n - 1) + 1;
+    }
+
+    std::vector<std::vector<std::vector<T, aligned_allocator<T>>>> _buckets;
+    size_t _allocations;
 };
 
+// stride == 0 creates a packed image (stride == w). When a pool is given the
+// buffer comes from it (and is not cleared).
 template<typename T>
-image<T> image_create(uint16_t w, uint16_t h) {
+image<T> image_create(uint16_t w, uint16_t h, size_t stride = 0, image_pool<T>* pool = nullptr) {
+    if (pool)
+        return pool->create(w, h, stride);
+
+    if (stride == 0)
+        stride = w;
+    if (stride < w)
+        throw std::runtime_error("geometry exception (stride < w)");
+
     image<T> img;
-    img.bits = std::make_shared<std::vector < T >> (w * h);
+    img.bits.resize(stride * h);
     img.w = w;
     img.h = h;
+    img.stride = stride;
     return img;
 }
 
+// Image whose rows each start on a cache line. This is what luminance and
+// integral images get, since those are what the detection loops read.
+template<typename T>
+image<T> image_create_padded(uint16_t w, uint16_t h, image_pool<T>* pool = nullptr) {
+    return image_create<T>(w, h, image_padded_stride<T>(w), pool);
+}
+
 // Load ppm image from disk into ARGB buffer
 image<uint32_t> image_create_from_ppm(const std::string& fileName);
 
 void image_write_ppm(const image<uint32_t>& img, const std::string& fileName);
 
+// Sub-window of a view. No pixels are copied, the result aliases v.
+template<typename T>
+image_view<T> image_roi(const image_view<T>& v, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    if (x + width > v.w)
+        throw std::runtime_error("geometry exception (x + width > v.w)");
+    if (y + height > v.h)
+        throw std::runtime_error("geometry exception (y + height > v.h)");
+
+    return image_view<T>(v.bits + x + (y * v.stride), width, height, v.stride, v.x + x, v.y + y);
+}
+
+template<typename T>
+image_view<const T> image_roi(const image<T>& img, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    return image_roi(image_view<const T>(img), x, y, width, height);
+}
+
+template<typename T>
+image_view<T> image_roi(image<T>& img, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+    return image_roi(image_view<T>(img), x, y, width, height);
+}
+
+// Copy the pixels of src into dst. Both views must have the same dimensions.
+template<typename S, typename T>
+void image_blit(const image_view<S>& src, const image_view<T>& dst) {
+    if (src.w != dst.w || src.h != dst.h)
+        throw std::runtime_error("geometry exception (src and dst dimensions differ)");
+
+    for (uint16_t h = 0; h < src.h; ++h)
+        std::copy(src.row(h), src.row(h) + src.w, dst.row(h));
+}
+
 template<typename T>
-void image_blit(const image<T> srcImage, uint16_t sx, uint16_t sy, uint16_t width, uint16_t height, image<T> dstImage, uint16_t dx, uint16_t dy) {
+void image_blit(const image<T>& srcImage, uint16_t sx, uint16_t sy, uint16_t width, uint16_t height, image<T>& dstImage, uint16_t dx, uint16_t dy) {
     if (sx + width > srcImage.w)
         throw std::runtime_error("geometry exception (sx + width > srcImage.w)");
     if (sy + height > srcImage.h)
@@ -44,164 +282,203 @@ void image_blit(const image<T> srcImage, uint16_t sx, uint16_t sy, uint16_t widt
     if (dy + height > dstImage.h)
         throw std::runtime_error("geometry exception (dy + height > dstImage.h)");
 
-    const std::vector<T>& src = *srcImage.bits;
-    std::vector<T>& dst = *dstImage.bits;
+    image_blit(image_roi(srcImage, sx, sy, width, height), image_roi(dstImage, dx, dy, width, height));
+}
+
+// Materialize a view into a newly allocated, tightly packed image.
+template<typename V>
+image<typename std::remove_const<V>::type> image_copy(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    auto out = image_create<typename std::remove_const<V>::type>(input.w, input.h, 0, pool);
+    image_blit(input, image_view<typename std::remove_const<V>::type>(out));
+    return out;
+}
 
-    for (uint16_t h = 0; h < height; ++h) {
-        for (uint16_t w = 0; w < width; ++w) {
-            dst[ (dx + w) + ((dy + h) * dstImage.w) ] = src[ (sx + w) + ((sy + h) * srcImage.w)];
-        }
-    }
+template<typename T>
+image<T> image_copy(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_copy(image_view<const T>(input), pool);
 }
 
 void aspect_correct_dimensions(uint16_t streamWidth, uint16_t streamHeight,
         uint16_t requestedWidth, uint16_t requestedHeight,
         uint16_t& destWidth, uint16_t& destHeight);
 
-template<typename T>
-image<T> image_argb_to_lum(const image<uint32_t>& rgb) {
-    image<T> out;
-    out.w = rgb.w;
-    out.h = rgb.h;
-    out.bits = std::make_shared<std::vector < T >> (rgb.w * rgb.h);
-
-    zip_transform([](T out, uint32_t in) {
-        double b = in >> 24;
-        double g = (in >> 16) & 0xFF;
-        double r = (in >> 8) & 0xFF;
-        return (T) (0.2126f * r + 0.7152f * g + 0.0722f * b);
-    },
-    out.bits->begin(), out.bits->end(),
-            rgb.bits->begin());
+template<typename T, typename V>
+image<T> image_argb_to_lum(const image_view<V>& rgb, image_pool<T>* pool = nullptr) {
+    auto out = image_create_padded<T>(rgb.w, rgb.h, pool);
+
+    T* dst = out.bits.data();
+    for (uint16_t y = 0; y < rgb.h; ++y, dst += out.stride) {
+        zip_transform([](T out, uint32_t in) {
+            double b = in >> 24;
+            double g = (in >> 16) & 0xFF;
+            double r = (in >> 8) & 0xFF;
+            return (T) (0.2126f * r + 0.7152f * g + 0.0722f * b);
+        },
+        dst, dst + rgb.w,
+                rgb.row(y));
+    }
 
     return out;
 }
 
 template<typename T>
-image<uint32_t> image_lum_to_argb(const image<T>& lum) {
-    image<uint32_t> out;
-    out.w = lum.w;
-    out.h = lum.h;
-    out.bits = std::make_shared<std::vector < uint32_t >> (lum.w * lum.h);
-
-    zip_transform([](uint32_t out, T in) {
-        uint32_t word;
-        if (std::is_floating_point<T>())
-                word = 255 << 24 | ((uint8_t) in) << 16 | ((uint8_t) in) << 8 | ((uint8_t) in);
-        else word = 255 << 24 | ((uint8_t) in) << 16 | ((uint8_t) in) << 8 | ((uint8_t) in);
-            return word;
-        },
-    out.bits->begin(), out.bits->end(),
-            lum.bits->begin());
+image<T> image_argb_to_lum(const image<uint32_t>& rgb, image_pool<T>* pool = nullptr) {
+    return image_argb_to_lum<T>(image_view<const uint32_t>(rgb), pool);
+}
+
+template<typename V>
+image<uint32_t> image_lum_to_argb(const image_view<V>& lum, image_pool<uint32_t>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create<uint32_t>(lum.w, lum.h, 0, pool);
+
+    uint32_t* dst = out.bits.data();
+    for (uint16_t y = 0; y < lum.h; ++y, dst += out.stride) {
+        zip_transform([](uint32_t out, T in) {
+            uint32_t word;
+            if (std::is_floating_point<T>())
+                    word = 255 << 24 | ((uint8_t) in) << 16 | ((uint8_t) in) << 8 | ((uint8_t) in);
+            else word = 255 << 24 | ((uint8_t) in) << 16 | ((uint8_t) in) << 8 | ((uint8_t) in);
+                return word;
+            },
+        dst, dst + lum.w,
+                lum.row(y));
+    }
 
     return out;
 }
 
 template<typename T>
-image<T> image_normalize(const image<T>& input) {
+image<uint32_t> image_lum_to_argb(const image<T>& lum, image_pool<uint32_t>* pool = nullptr) {
+    return image_lum_to_argb(image_view<const T>(lum), pool);
+}
+
+template<typename V>
+image<typename std::remove_const<V>::type> image_normalize(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+
     T mean = std::is_floating_point<T>() ? 0.0 : 0;
-    mean = std::accumulate(input.bits->begin(), input.bits->end(),
-            mean);
+    for (uint16_t y = 0; y < input.h; ++y)
+        mean = std::accumulate(input.row(y), input.row(y) + input.w, mean);
     mean /= input.w * input.h;
 
     T stdev = std::is_floating_point<T>() ? 0.0 : 0;
-    stdev = std::accumulate(input.bits->begin(), input.bits->end(),
-            stdev,
-            [mean](T accum, T val) {
-                return accum + pow(val - mean, 2);
-            });
+    for (uint16_t y = 0; y < input.h; ++y) {
+        stdev = std::accumulate(input.row(y), input.row(y) + input.w,
+                stdev,
+                [mean](T accum, T val) {
+                    return accum + pow(val - mean, 2);
+                });
+    }
     stdev /= input.w * input.h;
     stdev = sqrt(stdev);
 
-    image<T> out;
-    out.w = input.w;
-    out.h = input.h;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
+    auto out = image_create_padded<T>(input.w, input.h, pool);
 
-    zip_transform([mean, stdev](T out, T in) {
-        return (in - mean) / stdev;
-    },
-    out.bits->begin(), out.bits->end(),
-            input.bits->begin());
+    T* dst = out.bits.data();
+    for (uint16_t y = 0; y < input.h; ++y, dst += out.stride) {
+        zip_transform([mean, stdev](T out, T in) {
+            return (in - mean) / stdev;
+        },
+        dst, dst + input.w,
+                input.row(y));
+    }
 
     return out;
 }
 
 template<typename T>
-image<T> image_integral(const image<T>& input) {
-    image<T> out;
-    out.w = input.w;
-    out.h = input.h;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
-
-    std::vector<T> s(input.w * input.h);
+image<T> image_normalize(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_normalize(image_view<const T>(input), pool);
+}
 
-    auto& img = *input.bits;
-    auto& ii = *out.bits;
+// Write the integral of input into output (same dimensions).
+template<typename V, typename T>
+void image_integral(const image_view<V>& input, const image_view<T>& output) {
+    if (input.w != output.w || input.h != output.h)
+        throw std::runtime_error("geometry exception (input and output dimensions differ)");
 
     for (uint16_t y = 0; y < input.h; ++y) {
+        const V* img = input.row(y);
+        T* ii = output.row(y);
+        T s = 0;
         for (uint16_t x = 0; x < input.w; ++x) {
-            if (x == 0)
-                s[(y * input.w) + x] = img[(y * input.w) + x];
-            else s[(y * input.w) + x] = s[(y * input.w) + x - 1] + img[(y * input.w) + x];
+            s += img[x];
             if (y == 0)
-                ii[(y * input.w) + x] = s[(y * input.w) + x];
-            else ii[(y * input.w) + x] = ii[((y - 1) * input.w) + x] + s[(y * input.w) + x];
+                ii[x] = s;
+            else ii[x] = ii[x - output.stride] + s;
         }
     }
+}
 
+template<typename V>
+image<typename std::remove_const<V>::type> image_integral(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create_padded<T>(input.w, input.h, pool);
+    image_integral(input, image_view<T>(out));
     return out;
 }
 
 template<typename T>
-image<T> image_squared_integral(const image<T>& input) {
-    image<T> out;
-    out.w = input.w;
-    out.h = input.h;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
-
-    std::vector<T> s(input.w * input.h);
+image<T> image_integral(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_integral(image_view<const T>(input), pool);
+}
 
-    auto& img = *input.bits;
-    auto& ii = *out.bits;
+// Write the squared integral of input into output (same dimensions).
+template<typename V, typename T>
+void image_squared_integral(const image_view<V>& input, const image_view<T>& output) {
+    if (input.w != output.w || input.h != output.h)
+        throw std::runtime_error("geometry exception (input and output dimensions differ)");
 
     for (uint16_t y = 0; y < input.h; ++y) {
+        const V* img = input.row(y);
+        T* ii = output.row(y);
+        T s = 0;
         for (uint16_t x = 0; x < input.w; ++x) {
-            if (x == 0)
-                s[(y * input.w) + x] = pow(img[(y * input.w) + x], 2);
-            else s[(y * input.w) + x] = s[(y * input.w) + x - 1] + pow(img[(y * input.w) + x], 2);
+            s += pow(img[x], 2);
             if (y == 0)
-                ii[(y * input.w) + x] = s[(y * input.w) + x];
-            else ii[(y * input.w) + x] = ii[((y - 1) * input.w) + x] + s[(y * input.w) + x];
+                ii[x] = s;
+            else ii[x] = ii[x - output.stride] + s;
         }
     }
+}
 
+template<typename V>
+image<typename std::remove_const<V>::type> image_squared_integral(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create_padded<T>(input.w, input.h, pool);
+    image_squared_integral(input, image_view<T>(out));
     return out;
 }
 
 template<typename T>
-T image_integral_rectangle(const image<T>& input, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
-    auto& ii = *input.bits;
-    T value = ii[((y + h - 1) * input.w)+(x + w - 1)];
-    if (x > 0) value -= ii[((y + h - 1) * input.w)+(x - 1)];
-    if (y > 0) value -= ii[(y - 1) * input.w + (x + w - 1)];
-    if (x > 0 && y > 0) value += ii[(y - 1) * input.w + (x - 1)];
+image<T> image_squared_integral(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_squared_integral(image_view<const T>(input), pool);
+}
+
+// input must view a whole integral image (the view origin is the integral origin).
+template<typename V>
+typename std::remove_const<V>::type image_integral_rectangle(const image_view<V>& input, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    typename std::remove_const<V>::type value = input.at(x + w - 1, y + h - 1);
+    if (x > 0) value -= input.at(x - 1, y + h - 1);
+    if (y > 0) value -= input.at(x + w - 1, y - 1);
+    if (x > 0 && y > 0) value += input.at(x - 1, y - 1);
     return value;
 }
 
 template<typename T>
-image<T> image_rotate_90(const image<T>& input) {
-    image<T> out;
-    out.w = input.h;
-    out.h = input.w;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
+T image_integral_rectangle(const image<T>& input, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    return image_integral_rectangle(image_view<const T>(input), x, y, w, h);
+}
+
+template<typename V>
+image<typename std::remove_const<V>::type> image_rotate_90(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    auto out = image_create<typename std::remove_const<V>::type>(input.h, input.w, 0, pool);
 
-    std::vector<T>& img = *out.bits;
-    const std::vector<T>& src = *input.bits;
+    auto& img = out.bits;
 
     for (uint16_t y = 0; y < input.h; ++y) {
         for (uint16_t x = 0; x < input.w; ++x) {
-            img[input.h - 1 - y + (x * input.h)] = src[(y * input.w) + x];
+            img[input.h - 1 - y + (x * out.stride)] = input.at(x, y);
         }
     }
 
@@ -209,18 +486,19 @@ image<T> image_rotate_90(const image<T>& input) {
 }
 
 template<typename T>
-image<T> image_rotate_180(const image<T>& input) {
-    image<T> out;
-    out.w = input.w;
-    out.h = input.h;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
+image<T> image_rotate_90(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_rotate_90(image_view<const T>(input), pool);
+}
 
-    std::vector<T>& img = *out.bits;
-    const std::vector<T>& src = *input.bits;
+template<typename V>
+image<typename std::remove_const<V>::type> image_rotate_180(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    auto out = image_create<typename std::remove_const<V>::type>(input.w, input.h, 0, pool);
+
+    auto& img = out.bits;
 
     for (uint16_t y = 0; y < input.h; ++y) {
         for (uint16_t x = 0; x < input.w; ++x) {
-            img[((input.h - 1 - y) * input.w) + input.w - 1 - x] = src[(y * input.w) + x];
+            img[((input.h - 1 - y) * out.stride) + input.w - 1 - x] = input.at(x, y);
         }
     }
 
@@ -228,18 +506,19 @@ image<T> image_rotate_180(const image<T>& input) {
 }
 
 template<typename T>
-image<T> image_rotate_270(const image<T>& input) {
-    image<T> out;
-    out.w = input.h;
-    out.h = input.w;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
+image<T> image_rotate_180(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_rotate_180(image_view<const T>(input), pool);
+}
 
-    std::vector<T>& img = *out.bits;
-    const std::vector<T>& src = *input.bits;
+template<typename V>
+image<typename std::remove_const<V>::type> image_rotate_270(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    auto out = image_create<typename std::remove_const<V>::type>(input.h, input.w, 0, pool);
+
+    auto& img = out.bits;
 
     for (uint16_t y = 0; y < input.h; ++y) {
         for (uint16_t x = 0; x < input.w; ++x) {
-            img[y + ((input.w - x - 1) * input.h)] = src[(y * input.w) + x];
+            img[y + ((input.w - x - 1) * out.stride)] = input.at(x, y);
         }
     }
 
@@ -247,79 +526,291 @@ image<T> image_rotate_270(const image<T>& input) {
 }
 
 template<typename T>
-image<T> image_mirror_vertical(const image<T>& input) {
-    image<T> out;
-    out.w = input.w;
-    out.h = input.h;
-    out.bits = std::make_shared<std::vector < T >> (input.w * input.h);
+image<T> image_rotate_270(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_rotate_270(image_view<const T>(input), pool);
+}
 
-    std::vector<T>& img = *out.bits;
-    const std::vector<T>& src = *input.bits;
+template<typename V>
+image<typename std::remove_const<V>::type> image_mirror_vertical(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    auto out = image_create<typename std::remove_const<V>::type>(input.w, input.h, 0, pool);
 
-    for (uint16_t y = 0; y < input.h; ++y) {
-        for (uint16_t x = 0; x < input.w; ++x) {
-            img[(((input.h - 1) - y) * input.w) + x] = src[(y * input.w) + x];
+    for (uint16_t y = 0; y < input.h; ++y)
+        std::copy(input.row(y), input.row(y) + input.w, out.bits.data() + (((input.h - 1) - y) * out.stride));
+
+    return out;
+}
+
+template<typename T>
+image<T> image_mirror_vertical(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_mirror_vertical(image_view<const T>(input), pool);
+}
+
+// Bilinear resize of packed 32 bit ARGB pixels into output (which may be a
+// sub-window of a larger image, e.g. when letterboxing). Fixed point with
+// per-column offsets and weights computed once per call; the kernel is picked
+// at runtime (AVX2, SSE2 or scalar, see simd_supported()). For single channel
+// images use image_resize_lum or image_downscale_area.
+void image_resize_argb(const image_view<const uint32_t>& input, const image_view<uint32_t>& output);
+
+template<typename V, typename T>
+void image_resize(const image_view<V>& input, const image_view<T>& output) {
+    static_assert(std::is_same<typename std::remove_const<V>::type, uint32_t>::value && std::is_same<T, uint32_t>::value,
+            "image_resize works on ARGB images, use image_resize_lum or image_downscale_area for luminance");
+    image_resize_argb(input, output);
+}
+
+template<typename V>
+image<typename std::remove_const<V>::type> image_resize(const image_view<V>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create<T>(outputWidth, outputHeight, 0, pool);
+    image_resize(input, image_view<T>(out));
+    return out;
+}
+
+template<typename T>
+image<T> image_resize(const image<T>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<T>* pool = nullptr) {
+    return image_resize(image_view<const T>(input), outputWidth, outputHeight, pool);
+}
+
+// Bilinear resize for single channel (luminance) images. Pixel centres are
+// aligned, samples outside the input are clamped to the edge.
+template<typename V, typename T>
+void image_resize_lum(const image_view<V>& input, const image_view<T>& output) {
+    double xRatio = (double) input.w / output.w;
+    double yRatio = (double) input.h / output.h;
+
+    for (uint16_t i = 0; i < output.h; ++i) {
+        double sy = std::min(std::max((i + 0.5) * yRatio - 0.5, 0.0), (double) (input.h - 1));
+        uint16_t y0 = (uint16_t) sy;
+        uint16_t y1 = std::min(y0 + 1, input.h - 1);
+        double yDiff = sy - y0;
+
+        const V* r0 = input.row(y0);
+        const V* r1 = input.row(y1);
+        T* dst = output.row(i);
+
+        for (uint16_t j = 0; j < output.w; ++j) {
+            double sx = std::min(std::max((j + 0.5) * xRatio - 0.5, 0.0), (double) (input.w - 1));
+            uint16_t x0 = (uint16_t) sx;
+            uint16_t x1 = std::min(x0 + 1, input.w - 1);
+            double xDiff = sx - x0;
+
+            double top = r0[x0] + (r0[x1] - r0[x0]) * xDiff;
+            double bottom = r1[x0] + (r1[x1] - r1[x0]) * xDiff;
+            dst[j] = (T) (top + (bottom - top) * yDiff);
         }
     }
+}
 
+template<typename V>
+image<typename std::remove_const<V>::type> image_resize_lum(const image_view<V>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create_padded<T>(outputWidth, outputHeight, pool);
+    image_resize_lum(input, image_view<T>(out));
     return out;
 }
 
 template<typename T>
-image<T> image_resize(const image<T>& input, uint16_t outputWidth, uint16_t outputHeight) {
-    image<T> out;
-    out.w = outputWidth;
-    out.h = outputHeight;
-    out.bits = std::make_shared<std::vector < T >> (outputWidth * outputHeight);
-    T* dst = &out.bits->at(0);
-    const T* src = &input.bits->at(0);
-
-    int a, b, c, d, x, y, index;
-    float x_ratio = ((float) (input.w - 1)) / outputWidth;
-    float y_ratio = ((float) (input.h - 1)) / outputHeight;
-    float x_diff, y_diff, blue, red, green;
-    int offset = 0;
-
-    for (int i = 0; i < outputHeight; i++) {
-        for (int j = 0; j < outputWidth; j++) {
-            x = (int) (x_ratio * j);
-            y = (int) (y_ratio * i);
-            x_diff = (x_ratio * j) - x;
-            y_diff = (y_ratio * i) - y;
-            index = (y * input.w + x);
-            a = src[index];
-            b = src[index + 1];
-            c = src[index + input.w];
-            d = src[index + input.w + 1];
-
-            // blue element
-            blue = (a & 0xff)*(1 - x_diff)*(1 - y_diff) + (b & 0xff)*(x_diff)*(1 - y_diff) +
-                    (c & 0xff)*(y_diff)*(1 - x_diff) + (d & 0xff)*(x_diff * y_diff);
-
-            // green element
-            green = ((a >> 8)&0xff)*(1 - x_diff)*(1 - y_diff) + ((b >> 8)&0xff)*(x_diff)*(1 - y_diff) +
-                    ((c >> 8)&0xff)*(y_diff)*(1 - x_diff) + ((d >> 8)&0xff)*(x_diff * y_diff);
-
-            // red element
-            red = ((a >> 16)&0xff)*(1 - x_diff)*(1 - y_diff) + ((b >> 16)&0xff)*(x_diff)*(1 - y_diff) +
-                    ((c >> 16)&0xff)*(y_diff)*(1 - x_diff) + ((d >> 16)&0xff)*(x_diff * y_diff);
-
-            dst [offset++] = 0xff << 24 |
-                    ((int) red) << 16 |
-                    ((int) green) << 8 |
-                    ((int) blue);
+image<T> image_resize_lum(const image<T>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<T>* pool = nullptr) {
+    return image_resize_lum(image_view<const T>(input), outputWidth, outputHeight, pool);
+}
+
+// Source spans and weights for area averaging between two fixed image sizes,
+// plus a scratch row. Build one per geometry with image_area_plan_create and
+// reuse it, image_downscale_area then does not allocate.
+struct image_area_plan {
+    uint16_t inW;
+    uint16_t inH;
+    uint16_t outW;
+    uint16_t outH;
+    // output column j averages source columns colFirst[j] .. colFirst[j] +
+    // colCount[j] - 1, with weights starting at colWeights[colOffset[j]].
+    std::vector<uint16_t> colFirst;
+    std::vector<uint16_t> colCount;
+    std::vector<uint32_t> colOffset;
+    std::vector<float> colWeights;
+    std::vector<uint16_t> rowFirst;
+    std::vector<uint16_t> rowCount;
+    std::vector<uint32_t> rowOffset;
+    std::vector<float> rowWeights;
+    std::vector<float, aligned_allocator<float>> accum;
+};
+
+// Weights of the source pixels covered by each of n output pixels spanning in
+// source pixels. Weights of one output sum to 1.
+inline void _image_area_taps(uint16_t in, uint16_t n,
+        std::vector<uint16_t>& first,
+        std::vector<uint16_t>& count,
+        std::vector<uint32_t>& offset,
+        std::vector<float>& weights) {
+    double ratio = (double) in / n;
+    for (uint16_t j = 0; j < n; ++j) {
+        double begin = j * ratio;
+        double end = std::min((j + 1) * ratio, (double) in);
+        uint16_t f = (uint16_t) begin;
+        first.push_back(f);
+        offset.push_back((uint32_t) weights.size());
+        uint16_t c = 0;
+        for (uint16_t k = f; k < in && k < end; ++k, ++c) {
+            double overlap = std::min(end, k + 1.0) - std::max(begin, (double) k);
+            weights.push_back((float) (overlap / ratio));
+        }
+        count.push_back(c);
+    }
+}
+
+inline image_area_plan image_area_plan_create(uint16_t inW, uint16_t inH, uint16_t outW, uint16_t outH) {
+    if (outW > inW || outH > inH || outW == 0 || outH == 0)
+        throw std::runtime_error("geometry exception (area averaging only downscales)");
+
+    image_area_plan plan;
+    plan.inW = inW;
+    plan.inH = inH;
+    plan.outW = outW;
+    plan.outH = outH;
+    _image_area_taps(inW, outW, plan.colFirst, plan.colCount, plan.colOffset, plan.colWeights);
+    _image_area_taps(inH, outH, plan.rowFirst, plan.rowCount, plan.rowOffset, plan.rowWeights);
+    plan.accum.resize(inW);
+    return plan;
+}
+
+// Area averaging downscale of a single channel image: every output pixel is
+// the mean of the source area it covers, so large reductions do not alias.
+// Separable: source rows are accumulated vertically into plan.accum (a
+// contiguous loop the compiler vectorizes), then reduced horizontally.
+template<typename V, typename T>
+void image_downscale_area(const image_view<V>& input, const image_view<T>& output, image_area_plan& plan) {
+    if (input.w != plan.inW || input.h != plan.inH || output.w != plan.outW || output.h != plan.outH)
+        throw std::runtime_error("geometry exception (image does not match area plan)");
+
+    float* accum = plan.accum.data();
+    for (uint16_t i = 0; i < output.h; ++i) {
+        const float* rw = &plan.rowWeights[plan.rowOffset[i]];
+        for (uint16_t k = 0; k < plan.rowCount[i]; ++k) {
+            const V* src = input.row(plan.rowFirst[i] + k);
+            float w = rw[k];
+            if (k == 0) {
+                for (uint16_t x = 0; x < input.w; ++x)
+                    accum[x] = w * (float) src[x];
+            } else {
+                for (uint16_t x = 0; x < input.w; ++x)
+                    accum[x] += w * (float) src[x];
+            }
+        }
+
+        T* dst = output.row(i);
+        for (uint16_t j = 0; j < output.w; ++j) {
+            const float* cw = &plan.colWeights[plan.colOffset[j]];
+            const float* a = accum + plan.colFirst[j];
+            float v = 0.0f;
+            for (uint16_t k = 0; k < plan.colCount[j]; ++k)
+                v += cw[k] * a[k];
+            dst[j] = std::is_integral<T>::value ? (T) (v + 0.5f) : (T) v;
         }
     }
+}
 
+template<typename V>
+image<typename std::remove_const<V>::type> image_downscale_area(const image_view<V>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto plan = image_area_plan_create(input.w, input.h, outputWidth, outputHeight);
+    auto out = image_create_padded<T>(outputWidth, outputHeight, pool);
+    image_downscale_area(input, image_view<T>(out), plan);
     return out;
 }
 
 template<typename T>
-void image_draw_rect(image<T>& input, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, T color) {
+image<T> image_downscale_area(const image<T>& input, uint16_t outputWidth, uint16_t outputHeight, image_pool<T>* pool = nullptr) {
+    return image_downscale_area(image_view<const T>(input), outputWidth, outputHeight, pool);
+}
+
+// 2x2 box decimation of one row pair into dst (n output pixels).
+template<typename V, typename T>
+inline void _image_decimate_row(const V* r0, const V* r1, T* dst, uint16_t n) {
+    for (uint16_t x = 0; x < n; ++x) {
+        auto sum = (r0[2 * x] + r1[2 * x]) + (r0[2 * x + 1] + r1[2 * x + 1]);
+        dst[x] = std::is_integral<T>::value ? (T) ((sum + 2) / 4) : (T) (sum * 0.25);
+    }
+}
+
+#ifdef __SSE2__
+
+inline void _image_decimate_row(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, uint16_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi32(2);
+    uint16_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) (r0 + 2 * x));
+        __m128i a1 = _mm_loadu_si128((const __m128i*) (r0 + 2 * x + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*) (r1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128((const __m128i*) (r1 + 2 * x + 16));
+
+        // vertical sums as 16 bit, then adjacent pairs summed into 32 bit
+        __m128i p0 = _mm_madd_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)), ones);
+        __m128i p1 = _mm_madd_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)), ones);
+        __m128i p2 = _mm_madd_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)), ones);
+        __m128i p3 = _mm_madd_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero)), ones);
+
+        p0 = _mm_srai_epi32(_mm_add_epi32(p0, two), 2);
+        p1 = _mm_srai_epi32(_mm_add_epi32(p1, two), 2);
+        p2 = _mm_srai_epi32(_mm_add_epi32(p2, two), 2);
+        p3 = _mm_srai_epi32(_mm_add_epi32(p3, two), 2);
+
+        _mm_storeu_si128((__m128i*) (dst + x), _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3)));
+    }
+    for (; x < n; ++x)
+        dst[x] = (uint8_t) ((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) / 4);
+}
+
+inline void _image_decimate_row(const float* r0, const float* r1, float* dst, uint16_t n) {
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    uint16_t x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 lo = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x), _mm_loadu_ps(r1 + 2 * x));
+        __m128 hi = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x + 4), _mm_loadu_ps(r1 + 2 * x + 4));
+        __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(dst + x, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+    }
+    for (; x < n; ++x)
+        dst[x] = ((r0[2 * x] + r1[2 * x]) + (r0[2 * x + 1] + r1[2 * x + 1])) * 0.25f;
+}
+
+#endif
+
+// 2x downscale by averaging 2x2 blocks. output must be input.w / 2 by
+// input.h / 2; an odd last row or column is dropped. uint8_t and float have
+// SSE2 kernels.
+template<typename V, typename T>
+void image_downscale_2x(const image_view<V>& input, const image_view<T>& output) {
+    if (output.w != input.w / 2 || output.h != input.h / 2)
+        throw std::runtime_error("geometry exception (output is not half of input)");
+
+    typedef typename std::remove_const<V>::type S;
+    for (uint16_t y = 0; y < output.h; ++y)
+        _image_decimate_row((const S*) input.row(2 * y), (const S*) input.row(2 * y + 1), output.row(y), output.w);
+}
+
+template<typename V>
+image<typename std::remove_const<V>::type> image_downscale_2x(const image_view<V>& input, image_pool<typename std::remove_const<V>::type>* pool = nullptr) {
+    typedef typename std::remove_const<V>::type T;
+    auto out = image_create_padded<T>(input.w / 2, input.h / 2, pool);
+    image_downscale_2x(input, image_view<T>(out));
+    return out;
+}
+
+template<typename T>
+image<T> image_downscale_2x(const image<T>& input, image_pool<T>* pool = nullptr) {
+    return image_downscale_2x(image_view<const T>(input), pool);
+}
+
+template<typename T>
+void image_draw_rect(const image_view<T>& input, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, T color) {
     uint16_t w = x2 - x1;
     uint16_t h = y2 - y1;
 
-    T* dst = &input.bits->at(0) + x1 + (y1 * input.w);
+    T* dst = input.bits + x1 + (y1 * input.stride);
 
     // top line
     for (uint16_t i = 0; i < w; ++i)
@@ -327,17 +818,22 @@ void image_draw_rect(image<T>& input, uint16_t x1, uint16_t y1, uint16_t x2, uin
 
     if (h > 2) {
         for (uint16_t i = 0; i < (h - 2); ++i) {
-            dst += (input.w - w);
+            dst += (input.stride - w);
             *dst = color;
             dst += w;
             *dst = color;
         }
     }
 
-    dst += (input.w - w);
+    dst += (input.stride - w);
 
     for (uint16_t i = 0; i < w; ++i)
         *dst++ = color;
 }
 
+template<typename T>
+void image_draw_rect(image<T>& input, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, T color) {
+    image_draw_rect(image_view<T>(input), x1, y1, x2, y2, color);
+}
+
 #endif
@@ -1,12 +1,15 @@
 
 #include "strong_classifier.h"
+#include <algorithm>
+#include <limits>
 
 using namespace std;
 
 strong_classifier::strong_classifier() :
 _wcs(),
 _weights(),
-_threshold(0.0) {
+_threshold(0.0),
+_rejection() {
 }
 
 strong_classifier::strong_classifier(const vector<weak_classifier> wcs,
@@ -14,7 +17,8 @@ strong_classifier::strong_classifier(const vector<weak_classifier> wcs,
         double threshold) :
 _wcs(wcs),
 _weights(_wcs.size()),
-_threshold(threshold) {
+_threshold(threshold),
+_rejection() {
     for (size_t i = 0; i < _wcs.size(); ++i)
         _weights[i] = weights[i];
 }
@@ -22,11 +26,18 @@ _threshold(threshold) {
 strong_classifier::~strong_classifier() noexcept {
 }
 
-bool strong_classifier::classify(const image<double>& img, uint16_t x, uint16_t y, double mean, double stdev) {
+bool strong_classifier::classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const {
     double score = 0.0;
-    size_t i = 0;
-    for (auto& wc : _wcs)
-        score += _weights[i++] * wc.classify(img, x, y, mean, stdev);
+    return classify(img, x, y, mean, stdev, score);
+}
+
+bool strong_classifier::classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev, double& score) const {
+    bool soft = !_rejection.empty();
+    for (size_t i = 0; i < _wcs.size(); ++i) {
+        score += _weights[i] * _wcs[i].classify(img, x, y, mean, stdev);
+        if (soft && score < _rejection[i])
+            return false;
+    }
 
     if (score >= _threshold)
         return true;
@@ -45,15 +56,34 @@ void strong_classifier::scale(double s) {
         wc.scale(s);
 }
 
-void strong_classifier::optimize_threshold(const vector<image<double>>&positiveSet,
-        double maxfnr) {
+strong_classifier strong_classifier::scaled(double s, uint16_t window) const {
+    vector<weak_classifier> wcs;
+    for (auto& wc : _wcs)
+        wcs.push_back(wc.scaled(s, window));
+    strong_classifier sc(wcs, _weights, _threshold);
+    sc._rejection = _rejection;
+    return sc;
+}
+
+strong_classifier strong_classifier::transformed(view_transform t, uint16_t window) const {
+    vector<weak_classifier> wcs;
+    for (auto& wc : _wcs)
+        wcs.push_back(wc.transformed(t, window));
+    strong_classifier sc(wcs, _weights, _threshold);
+    sc._rejection = _rejection;
+    return sc;
+}
+
+void strong_classifier::optimize_threshold(const vector<image_view<const double>>&positiveSet,
+        double maxfnr,
+        const vector<double>& startScores) {
     size_t wf;
     double thr;
     size_t positiveSetSize = positiveSet.size();
     vector<double> scores(positiveSetSize);
 
     for (size_t i = 0; i < positiveSetSize; ++i) {
-        scores[i] = 0.0;
+        scores[i] = startScores.empty() ? 0.0 : startScores[i];
         wf = 0;
         for (auto& wc : _wcs) {
             scores[i] += _weights[wf++] * wc.classify(positiveSet[i], 0, 0, 0.0, 1.0);
@@ -72,7 +102,33 @@ void strong_classifier::optimize_threshold(const vector<image<double>>&positiveS
     }
 }
 
-double strong_classifier::fnr(const vector<image<double>>&positiveSet) {
+void strong_classifier::calibrate_rejection(const vector<image_view<const double>>&positiveSet,
+        const vector<double>& startScores) {
+    vector<double> rejection(_wcs.size(), numeric_limits<double>::infinity());
+    vector<double> partial(_wcs.size());
+    bool any = false;
+
+    for (size_t i = 0; i < positiveSet.size(); ++i) {
+        double score = startScores.empty() ? 0.0 : startScores[i];
+        for (size_t w = 0; w < _wcs.size(); ++w) {
+            score += _weights[w] * _wcs[w].classify(positiveSet[i], 0, 0, 0.0, 1.0);
+            partial[w] = score;
+        }
+
+        // positives the stage rejects anyway do not constrain the traces
+        if (score < _threshold)
+            continue;
+        for (size_t w = 0; w < _wcs.size(); ++w)
+            rejection[w] = min(rejection[w], partial[w]);
+        any = true;
+    }
+
+    if (any)
+        _rejection = rejection;
+    else _rejection.clear();
+}
+
+double strong_classifier::fnr(const vector<image_view<const double>>&positiveSet) const {
     size_t fn = 0;
     for (auto& img : positiveSet) {
         if (classify(img, 0, 0, 0.0, 1.0) == false)
@@ -82,7 +138,7 @@ double strong_classifier::fnr(const vector<image<double>>&positiveSet) {
     return ((double) fn) / ((double) positiveSet.size());
 }
 
-double strong_classifier::fpr(const vector<image<double>>&negativeSet) {
+double strong_classifier::fpr(const vector<image_view<const double>>&negativeSet) const {
     size_t fp = 0;
     for (auto& img : negativeSet) {
         if (classify(img, 0, 0, 0.0, 1.0) == true)
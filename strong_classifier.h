@@ -6,6 +6,13 @@
 #include "weak_classifier.h"
 #include "ppm.h"
 
+// Like weak_classifier, everything const here is reentrant: a strong
+// classifier that is no longer being trained can be shared between threads.
+//
+// A stage can optionally carry rejection traces (a soft cascade): one
+// threshold per weak classifier on the running score, so a window that is
+// clearly negative leaves the stage after a few weak classifiers instead of
+// summing all of them. calibrate_rejection sets them from the positive set.
 class strong_classifier {
 public:
     strong_classifier();
@@ -14,25 +21,63 @@ public:
             double threshold);
     ~strong_classifier() noexcept;
 
-    bool classify(const image<double>& img, uint16_t x, uint16_t y, double mean, double stdev);
+    bool classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev) const;
+
+    // Same, with the running score starting from score (see
+    // cascade_classifier::set_carry_score) and left in it: the stage score,
+    // or the partial score where a rejection trace stopped the window.
+    bool classify(const image_view<const double>& img, uint16_t x, uint16_t y, double mean, double stdev, double& score) const;
     void add(const weak_classifier& wc, double weight);
     void scale(double s);
-    void optimize_threshold(const std::vector<image<double>>&positiveSet, double maxfnr);
-    double fnr(const std::vector<image<double>>&positiveSet);
-    double fpr(const std::vector<image<double>>&negativeSet);
+    strong_classifier scaled(double s, uint16_t window) const;
+    strong_classifier transformed(view_transform t, uint16_t window) const;
+    // startScores, when given, is where each sample's running score starts.
+    void optimize_threshold(const std::vector<image_view<const double>>&positiveSet, double maxfnr,
+            const std::vector<double>& startScores = std::vector<double>());
+
+    // Rejection trace after each weak classifier: the lowest running score
+    // any positive the stage accepts has at that point (direct backward
+    // pruning), so exiting early costs none of those positives. Call it after
+    // optimize_threshold, with the same samples.
+    void calibrate_rejection(const std::vector<image_view<const double>>&positiveSet,
+            const std::vector<double>& startScores = std::vector<double>());
+
+    void clear_rejection() {
+        _rejection.clear();
+    }
+
+    // Empty when the stage has no rejection traces.
+    const std::vector<double>& get_rejection() const {
+        return _rejection;
+    }
+    double fnr(const std::vector<image_view<const double>>&positiveSet) const;
+    double fpr(const std::vector<image_view<const double>>&negativeSet) const;
 
+    // Scales the stage threshold. The rejection traces were calibrated for
+    // the old threshold and are dropped, the stage is hard again until
+    // calibrate_rejection runs on it.
     void strictness(double p) {
         _threshold *= p;
+        _rejection.clear();
     }
 
-    std::vector<weak_classifier> get_weak_classifiers() {
+    const std::vector<weak_classifier>& get_weak_classifiers() const {
         return _wcs;
     }
 
+    const std::vector<double>& get_weights() const {
+        return _weights;
+    }
+
+    double get_threshold() const {
+        return _threshold;
+    }
+
 protected:
     std::vector<weak_classifier> _wcs;
     std::vector<double> _weights;
     double _threshold;
+    std::vector<double> _rejection;
 };
 
 #endif
@@ -0,0 +1,1372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include "detector.h"
+#include "cascade_evaluator.h"
+#include "grouping.h"
+#include "tiled_detector.h"
+#include "video_detector.h"
+#include "motion_gate.h"
+#include "detection_mask.h"
+#include "utils.h"
+
+#include "test_synthetic_data.cpp"
+
+using namespace std;
+
+// Count every heap allocation so the steady state test can prove there are none.
+static atomic<size_t> heapAllocations(0);
+
+// While set, allocations fail on every thread but the main one, which waits a
+// little before each allocation so the others get to run first.
+static atomic<bool> failOtherThreads(false);
+static const thread::id mainThread = this_thread::get_id();
+
+void* operator new(size_t n) {
+    ++heapAllocations;
+    if (failOtherThreads) {
+        if (this_thread::get_id() != mainThread)
+            throw bad_alloc();
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    void* p = malloc(n);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+static bool centered_in(const detection& d, uint32_t x, uint32_t y, uint16_t size) {
+    int64_t cx = d.x + d.w / 2;
+    int64_t cy = d.y + d.h / 2;
+    return cx >= x && cx < x + size && cy >= y && cy < y + size;
+}
+
+static bool found(const vector<detection>& ds, uint32_t x, uint32_t y, uint16_t size, uint16_t slack) {
+    for (auto& d : ds) {
+        if (llabs((int64_t) (d.x + d.w / 2) - (int64_t) (x + size / 2)) <= slack &&
+                llabs((int64_t) (d.y + d.h / 2) - (int64_t) (y + size / 2)) <= slack &&
+                abs(d.w - size) <= size / 4)
+            return true;
+    }
+    return false;
+}
+
+// Cascade of random features of every type, stages pass roughly half of all
+// windows so the evaluator sees both outcomes everywhere.
+static cascade_classifier random_cascade(uint32_t seed) {
+    auto features = generate_feature_set(SYNTHETIC_BASE_RES);
+    cascade_classifier cc(SYNTHETIC_BASE_RES);
+    for (int stage = 0; stage < 4; ++stage) {
+        vector<weak_classifier> wcs;
+        for (int i = 0; i < 3; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            const feature& f = features[(seed >> 8) % features.size()];
+            wcs.push_back(weak_classifier(f, ((int) ((seed >> 4) & 0xf) - 8) * 0.1, (seed & 1) != 0));
+        }
+        cc.push_back(strong_classifier(wcs, {1.0, 2.0, 3.0}, 0.0));
+    }
+    return cc;
+}
+
+// Integrals of the normalized base resolution windows of lum, every step
+// pixels, the way learn.cpp feeds training samples to the classifiers.
+static vector<image<double>> window_samples(const image<double>& lum, uint16_t step) {
+    vector<image<double>> samples;
+    for (uint16_t y = 0; y + SYNTHETIC_BASE_RES <= lum.h; y += step)
+        for (uint16_t x = 0; x + SYNTHETIC_BASE_RES <= lum.w; x += step)
+            samples.push_back(image_integral(image_normalize(image_roi(lum, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES))));
+    return samples;
+}
+
+// random_cascade with rejection traces calibrated on samples, optionally
+// carrying scores between stages.
+static cascade_classifier soft_cascade(uint32_t seed, bool carry, const vector<image_view<const double>>& samples) {
+    auto cc = random_cascade(seed);
+    cc.set_carry_score(carry);
+    cc.calibrate_rejection(samples);
+    return cc;
+}
+
+// All pairs versions of the two grouping methods, to check the sweeps against.
+static vector<detection_group> naive_groups(const vector<detection>& ds, const group_params& params) {
+    size_t n = ds.size();
+    vector<size_t> owner(n);
+    for (size_t i = 0; i < n; ++i)
+        owner[i] = i;
+
+    if (params.method == GROUP_NEIGHBORS) {
+        // relabel until every similar pair has the same (smallest) label
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < n; ++j) {
+                    const detection& a = ds[i];
+                    const detection& b = ds[j];
+                    double delta = params.similarity * (min(a.w, b.w) + min(a.h, b.h)) * 0.5;
+                    bool similar = fabs((double) a.x - b.x) <= delta && fabs((double) a.y - b.y) <= delta &&
+                            fabs((double) (a.x + a.w) - (b.x + b.w)) <= delta && fabs((double) (a.y + a.h) - (b.y + b.h)) <= delta;
+                    if (similar && owner[j] < owner[i]) {
+                        owner[i] = owner[j];
+                        changed = true;
+                    }
+                }
+            }
+        }
+    } else {
+        vector<size_t> support(n, 0), order(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+            for (size_t j = 0; j < n; ++j)
+                support[i] += detection_iou(ds[i], ds[j]) >= params.overlap;
+        }
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return support[a] > support[b];
+        });
+        vector<bool> decided(n, false);
+        for (auto i : order) {
+            if (decided[i])
+                continue;
+            decided[i] = true;
+            for (size_t j = 0; j < n; ++j) {
+                if (!decided[j] && detection_iou(ds[i], ds[j]) >= params.overlap) {
+                    decided[j] = true;
+                    owner[j] = i;
+                }
+            }
+        }
+    }
+
+    vector<detection_group> groups;
+    for (size_t r = 0; r < n; ++r) {
+        if (owner[r] != r)
+            continue;
+        double sums[4] = {0, 0, 0, 0};
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (owner[i] == r) {
+                sums[0] += ds[i].x;
+                sums[1] += ds[i].y;
+                sums[2] += ds[i].w;
+                sums[3] += ds[i].h;
+                ++count;
+            }
+        }
+        if (count < params.minNeighbors)
+            continue;
+        detection rect = ds[r];
+        if (params.method == GROUP_NEIGHBORS)
+            rect = detection{(uint16_t) lround(sums[0] / count), (uint16_t) lround(sums[1] / count),
+                (uint16_t) lround(sums[2] / count), (uint16_t) lround(sums[3] / count), ds[r].cascade};
+        double confidence = 0.0;
+        for (size_t i = 0; i < n; ++i)
+            if (owner[i] == r)
+                confidence += detection_iou(ds[i], rect);
+        groups.push_back(detection_group{rect, count, confidence});
+    }
+    stable_sort(groups.begin(), groups.end(), [](const detection_group& a, const detection_group& b) {
+        return a.confidence > b.confidence;
+    });
+    return groups;
+}
+
+// Whether gate lets d through, block by block over the mask itself.
+static bool gate_open(const image<double>& mask, const window_gate& gate, const detection& d) {
+    int64_t cell = gate.cell;
+    auto first = [&](int64_t v) {
+        return (v >= 0) ? v / cell : -((-v + cell - 1) / cell);
+    };
+    int64_t bx0 = first((int64_t) d.x - gate.x), bx1 = first((int64_t) d.x + d.w - 1 - gate.x);
+    int64_t by0 = first((int64_t) d.y - gate.y), by1 = first((int64_t) d.y + d.h - 1 - gate.y);
+    double set = 0.0;
+    for (int64_t by = by0; by <= by1; ++by)
+        for (int64_t bx = bx0; bx <= bx1; ++bx)
+            if (bx >= 0 && by >= 0 && bx < mask.w && by < mask.h)
+                set += image_view<const double>(mask).at((uint16_t) bx, (uint16_t) by);
+    return set > 0.0 && set >= gate.minFraction * (double) ((bx1 - bx0 + 1) * (by1 - by0 + 1));
+}
+
+// img turned or flipped by t (see view_transform).
+static image<double> transformed_image(const image<double>& img, view_transform t) {
+    switch (t) {
+        case VIEW_ROTATE_90: return image_rotate_90(img);
+        case VIEW_ROTATE_180: return image_rotate_180(img);
+        case VIEW_ROTATE_270: return image_rotate_270(img);
+        case VIEW_MIRROR_HORIZONTAL: return image_rotate_180(image_mirror_vertical(img));
+        case VIEW_MIRROR_VERTICAL: return image_mirror_vertical(img);
+        default: return image_copy(img);
+    }
+}
+
+// Where the size x size window at (x, y) of a w x h image ends up in
+// transformed_image.
+static pair<uint32_t, uint32_t> transformed_window(uint16_t w, uint16_t h, view_transform t, uint32_t x, uint32_t y, uint16_t size) {
+    switch (t) {
+        case VIEW_ROTATE_90: return make_pair(h - y - size, x);
+        case VIEW_ROTATE_180: return make_pair(w - x - size, h - y - size);
+        case VIEW_ROTATE_270: return make_pair(y, w - x - size);
+        case VIEW_MIRROR_HORIZONTAL: return make_pair(w - x - size, y);
+        case VIEW_MIRROR_VERTICAL: return make_pair(x, h - y - size);
+        default: return make_pair(x, y);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    auto cc = synthetic_cascade();
+
+    {
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        auto ds = detect(cc, lum);
+        assert(!ds.empty());
+        assert(found(ds, 100, 60, 24, 0));
+        assert(found(ds, 200, 120, 48, 4));
+
+        // nothing outside the two planted objects
+        for (auto& d : ds)
+            assert(centered_in(d, 100, 60, 24) || centered_in(d, 200, 120, 48));
+    }
+
+    {
+        // scanning a region of interest reports detections in frame coordinates
+        auto lum = synthetic_scene(320, 240, 2);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        auto ds = detect(cc, image_roi(lum, 80, 40, 80, 80));
+        assert(found(ds, 100, 60, 24, 0));
+        assert(!found(ds, 200, 120, 48, 12));
+        for (auto& d : ds) {
+            assert(d.x >= 80 && d.x + d.w <= 160);
+            assert(d.y >= 40 && d.y + d.h <= 120);
+        }
+    }
+
+    {
+        // a detector reused on frames of the same size does not allocate
+        detector d(cc);
+        auto lum = synthetic_scene(320, 240, 4);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        size_t n = d.detect(lum).size();
+        assert(n > 0);
+        assert(d.detect(lum).size() == n);
+        size_t allocations = d.allocations();
+        size_t heap = heapAllocations;
+
+        for (int frame = 0; frame < 3; ++frame) {
+            auto& ds = d.detect(lum);
+            assert(ds.size() == n);
+            assert(found(ds, 100, 60, 24, 0));
+        }
+        assert(heapAllocations == heap);
+        assert(d.allocations() == allocations);
+
+        // as does a region of interest of the same size elsewhere in the frame
+        auto big = synthetic_scene(640, 480, 5);
+        d.detect(image_roi(big, 300, 200, 320, 240));
+        assert(d.allocations() == allocations);
+
+        // a new frame size re-sizes the buffers
+        auto other = synthetic_scene(160, 120, 6);
+        d.detect(other);
+        assert(d.allocations() > allocations);
+    }
+
+    {
+        // the pyramid and hybrid modes find the same objects
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        for (auto mode : {DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            detector d(cc, params);
+
+            auto& ds = d.detect(lum);
+            assert(found(ds, 100, 60, 24, 0));
+            assert(found(ds, 200, 120, 48, 4));
+            for (auto& det : ds)
+                assert(centered_in(det, 100, 60, 24) || centered_in(det, 200, 120, 48));
+
+            size_t allocations = d.allocations();
+            size_t heap = heapAllocations;
+            d.detect(lum);
+            assert(heapAllocations == heap);
+            assert(d.allocations() == allocations);
+        }
+    }
+
+    {
+        // hybrid with a scaleFactor of 3 or more skips octaves (scales 1, 3, 9
+        // are scanned on sources 1, 2 and 8), single frames and batches on
+        // threads alike
+        for (double factor : {3.0, 4.0}) {
+            uint16_t size = (uint16_t) (SYNTHETIC_BASE_RES * factor);
+            auto lum = synthetic_scene(320, 240, 7);
+            plant_checker(lum, 40, 60, 24);
+            plant_checker(lum, 200, 120, size);
+
+            for (unsigned threads : {1u, 3u}) {
+                detect_params params;
+                params.mode = DETECT_HYBRID;
+                params.scaleFactor = factor;
+                params.threads = threads;
+                detector d(cc, params);
+
+                auto& ds = d.detect(lum);
+                assert(found(ds, 40, 60, 24, 0));
+                assert(found(ds, 200, 120, size, size / 8));
+
+                auto& batch = d.detect(vector<image_view<const double>>{lum, lum});
+                assert(batch.size() == 2 && found(batch[1], 200, 120, size, size / 8));
+            }
+        }
+    }
+
+    {
+        // detectors can share one set of prebuilt cascade variants
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        detect_params params;
+        auto cascades = make_shared<const cascade_scales>(cc, detect_cascade_scales(params, cc.get_base_resolution()));
+        assert(cascades->scale(0) == 1.0);
+        assert(cascades->find(1.3) == 1);
+        assert((*cascades)[1].get_base_resolution() == 30);
+
+        detector a(cascades, params);
+        detector b(cascades, params);
+        auto& da = a.detect(lum);
+        auto& db = b.detect(lum);
+        assert(da.size() == db.size());
+        assert(found(da, 100, 60, 24, 0));
+        assert(found(db, 200, 120, 48, 4));
+
+        bool threw = false;
+        try {
+            params.mode = DETECT_HYBRID;
+            detector c(make_shared<const cascade_scales>(cc, vector<double>{1.0}), params);
+            c.detect(lum);
+        } catch (runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {
+        auto lum = synthetic_scene(100, 100, 3);
+        auto ds = detect(cc, lum);
+        assert(ds.empty());
+    }
+
+    {
+        // only the sources of scanned window sizes are built: one window size
+        // on a downscaled source costs that source (its pixels, area plan and
+        // two integrals) over one on the frame itself, whatever is skipped
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 47);
+        detect_params params;
+        params.mode = DETECT_PYRAMID;
+        params.maxWindow = SYNTHETIC_BASE_RES;
+        detector frame(cc, params);
+        frame.detect(lum);
+
+        double third = SYNTHETIC_BASE_RES * pow(params.scaleFactor, 3);
+        params.minWindow = (uint16_t) floor(third);
+        params.maxWindow = (uint16_t) ceil(third);
+        detector downscaled(cc, params);
+        assert(found(downscaled.detect(lum), 100, 60, 47, 4));
+        assert(downscaled.allocations() == frame.allocations() + 4);
+    }
+
+    {
+        // an empty first frame finds nothing, and the detector still works
+        // on the frames after it
+        detector d(cc);
+        assert(d.detect(image_view<const double>()).empty());
+        uint8_t none = 0;
+        assert(d.detect(&none, 0, 0, 0).empty());
+        d.begin(image_view<const double>());
+        assert(d.resume(100) && d.found().empty());
+
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        assert(found(d.detect(lum), 100, 60, 24, 0));
+    }
+
+    {
+        // threads split the scan into (scale, row band) tasks; the merged
+        // result is identical to the single threaded one, in the same order
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+        plant_checker(lum, 20, 150, 72);
+
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            auto expected = detect(cc, lum, params);
+            assert(!expected.empty());
+
+            for (unsigned threads : {2u, 3u, 8u}) {
+                params.threads = threads;
+                detector d(cc, params);
+                for (int frame = 0; frame < 3; ++frame) {
+                    size_t allocations = d.allocations();
+                    size_t heap = heapAllocations;
+                    auto& ds = d.detect(lum);
+                    if (frame > 0) {
+                        assert(heapAllocations == heap);
+                        assert(d.allocations() == allocations);
+                    }
+
+                    assert(ds.size() == expected.size());
+                    for (size_t i = 0; i < ds.size(); ++i) {
+                        assert(ds[i].x == expected[i].x && ds[i].y == expected[i].y);
+                        assert(ds[i].w == expected[i].w && ds[i].h == expected[i].h);
+                    }
+                }
+            }
+        }
+    }
+
+    {
+        // one const cascade shared by several threads, each with its own
+        // detector, gives every thread the single threaded result
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        const cascade_classifier& shared = cc;
+        static_assert(std::is_same<decltype(shared.get_strong_classifiers()), const vector<strong_classifier>&>::value,
+                "cascades hand out their stages by reference");
+        assert(&shared.get_strong_classifiers() == &cc.get_strong_classifiers());
+
+        detect_params params;
+        auto cascades = make_shared<const cascade_scales>(cc, detect_cascade_scales(params, cc.get_base_resolution()));
+        auto expected = detect(cc, lum, params);
+        vector<size_t> accepted(4, 0);
+        vector<char> same(4, 0);
+
+        vector<thread> threads;
+        for (size_t t = 0; t < 4; ++t) {
+            threads.push_back(thread([&, t]() {
+                detector d(cascades, params);
+                bool ok = true;
+                for (int frame = 0; frame < 5; ++frame) {
+                    auto& ds = d.detect(lum);
+                    ok = ok && ds.size() == expected.size();
+                    for (size_t i = 0; ok && i < ds.size(); ++i)
+                        ok = ds[i].x == expected[i].x && ds[i].y == expected[i].y && ds[i].w == expected[i].w;
+                }
+                same[t] = ok;
+
+                // and the cascade itself, evaluated directly
+                auto ii = image_integral(lum);
+                for (uint16_t y = 50; y < 70; ++y)
+                    for (uint16_t x = 90; x < 110; ++x)
+                        accepted[t] += shared.classify(ii, x, y, 128.0, 37.0);
+            }));
+        }
+        for (auto& t : threads)
+            t.join();
+
+        for (size_t t = 0; t < 4; ++t) {
+            assert(same[t]);
+            assert(accepted[t] == accepted[0]);
+        }
+    }
+
+    {
+        // rejection traces calibrated on a set keep every sample of it the
+        // cascade accepts, and elsewhere only ever reject more windows
+        auto lum = synthetic_scene(100, 60, 7);
+        plant_checker(lum, 30, 10, 24);
+        auto owned = window_samples(lum, 3);
+        vector<image_view<const double>> samples(owned.begin(), owned.end());
+        auto scene = synthetic_scene(100, 60, 8);
+        auto ii = image_integral(scene);
+
+        for (uint32_t seed : {1u, 2u, 3u}) {
+            for (bool carry : {false, true}) {
+                auto hard = random_cascade(seed);
+                hard.set_carry_score(carry);
+                auto soft = soft_cascade(seed, carry, samples);
+                for (auto& sc : soft.get_strong_classifiers())
+                    assert(sc.get_rejection().size() == sc.get_weak_classifiers().size());
+
+                for (auto& sample : samples)
+                    assert(soft.classify(sample, 0, 0, 0.0, 1.0) == hard.classify(sample, 0, 0, 0.0, 1.0));
+                assert(soft.fnr(samples) == hard.fnr(samples));
+
+                for (uint16_t y = 0; y + SYNTHETIC_BASE_RES <= ii.h; ++y)
+                    for (uint16_t x = 0; x + SYNTHETIC_BASE_RES <= ii.w; ++x)
+                        if (soft.classify(ii, x, y, 0.0, 1.0))
+                            assert(hard.classify(ii, x, y, 0.0, 1.0));
+
+                // scaled copies keep the traces
+                auto scaled = soft.scaled(2.0);
+                assert(scaled.carries_score() == carry);
+                assert(scaled.get_strong_classifiers()[0].get_rejection() == soft.get_strong_classifiers()[0].get_rejection());
+
+                // a new threshold invalidates the traces, the stages turn hard
+                auto strict = soft;
+                strict.strictness(1.5);
+                for (auto& sc : strict.get_strong_classifiers())
+                    assert(sc.get_rejection().empty());
+            }
+        }
+    }
+
+    {
+        // every SIMD level of the multi-window evaluator agrees with the
+        // cascade's own classify, at the image edges, for strided windows,
+        // partial blocks and windows with no variance
+        auto lum = synthetic_scene(100, 60, 11);
+        plant_checker(lum, 30, 10, 24);
+        auto ii = image_integral(lum);
+        auto sii = image_squared_integral(lum);
+        simd_level supported = simd_supported();
+
+        // few calibration samples give tight traces that reject often
+        auto small = synthetic_scene(32, 32, 5);
+        plant_checker(small, 4, 4, 24);
+        auto owned = window_samples(small, 2);
+        vector<image_view<const double>> samples(owned.begin(), owned.end());
+
+        for (uint32_t seed : {1u, 2u, 3u}) {
+            auto rc = random_cascade(seed);
+            auto soft = soft_cascade(seed, false, samples);
+            auto carried = soft_cascade(seed, true, samples);
+            for (const cascade_classifier* c : {(const cascade_classifier*) &cc, (const cascade_classifier*) &rc,
+                    (const cascade_classifier*) &soft, (const cascade_classifier*) &carried}) {
+                cascade_evaluator evaluator(*c, ii.stride);
+                size_t accepted = 0, rejected = 0;
+
+                for (uint16_t step : {1, 2, 3}) {
+                    size_t cols = (ii.w - SYNTHETIC_BASE_RES) / step + 1;
+                    vector<double> means(cols), stdevs(cols);
+                    vector<uint8_t> got(cols);
+
+                    for (uint16_t y = 0; y + SYNTHETIC_BASE_RES <= ii.h; ++y) {
+                        for (size_t i = 0; i < cols; ++i) {
+                            uint16_t x = (uint16_t) (i * step);
+                            double area = SYNTHETIC_BASE_RES * SYNTHETIC_BASE_RES;
+                            means[i] = image_integral_rectangle(ii, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES) / area;
+                            double variance = image_integral_rectangle(sii, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES) / area - means[i] * means[i];
+                            stdevs[i] = (i % 7 == 3) ? 0.0 : sqrt(variance);
+                        }
+
+                        for (simd_level level : {SIMD_NONE, SIMD_AVX2, SIMD_AVX512}) {
+                            if (level > supported)
+                                continue;
+                            simd_set_limit(level);
+                            // a sub-range exercises offsets and a partial block
+                            for (size_t first : {(size_t) 0, (size_t) 1}) {
+                                size_t count = cols - first - (first ? 3 : 0);
+                                evaluator.classify(ii, (uint16_t) (first * step), y, step, count,
+                                        means.data() + first, stdevs.data() + first, got.data() + first);
+                                for (size_t i = first; i < first + count; ++i) {
+                                    bool expected = c->classify(ii, (uint16_t) (i * step), y, means[i], stdevs[i]);
+                                    assert(got[i] == (expected ? 1 : 0));
+                                    accepted += expected;
+                                    rejected += !expected;
+                                }
+                            }
+                        }
+                        simd_set_limit(supported);
+                    }
+                }
+                assert(accepted > 0 && rejected > 0);
+            }
+        }
+
+        // and the detector finds the same windows at every level
+        auto scene = synthetic_scene(320, 240, 1);
+        plant_checker(scene, 100, 60, 24);
+        plant_checker(scene, 200, 120, 48);
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            detector d(cc, params);
+            simd_set_limit(SIMD_NONE);
+            auto expected = d.detect(scene);
+            for (simd_level level : {SIMD_AVX2, SIMD_AVX512}) {
+                simd_set_limit(level);
+                auto& ds = d.detect(scene);
+                assert(ds.size() == expected.size());
+                for (size_t i = 0; i < ds.size(); ++i)
+                    assert(ds[i].x == expected[i].x && ds[i].y == expected[i].y && ds[i].w == expected[i].w);
+            }
+            simd_set_limit(supported);
+        }
+    }
+
+    {
+        // breadth first evaluation keeps the survivors of every stage in
+        // order and accepts exactly what the cascade accepts
+        auto lum = synthetic_scene(100, 60, 11);
+        plant_checker(lum, 30, 10, 24);
+        auto ii = image_integral(lum);
+        auto sii = image_squared_integral(lum);
+        simd_level supported = simd_supported();
+        double area = SYNTHETIC_BASE_RES * SYNTHETIC_BASE_RES;
+
+        // few calibration samples give tight traces that reject often
+        auto small = synthetic_scene(32, 32, 5);
+        plant_checker(small, 4, 4, 24);
+        auto owned = window_samples(small, 2);
+        vector<image_view<const double>> samples(owned.begin(), owned.end());
+
+        for (uint32_t seed : {1u, 2u, 3u}) {
+            auto rc = random_cascade(seed);
+            auto soft = soft_cascade(seed, false, samples);
+            auto carried = soft_cascade(seed, true, samples);
+            for (const cascade_classifier* c : {(const cascade_classifier*) &cc, (const cascade_classifier*) &rc,
+                    (const cascade_classifier*) &soft, (const cascade_classifier*) &carried}) {
+                cascade_evaluator evaluator(*c, ii.stride);
+
+                for (simd_level level : {SIMD_NONE, SIMD_AVX2, SIMD_AVX512}) {
+                    if (level > supported)
+                        continue;
+                    simd_set_limit(level);
+
+                    cascade_survivors survivors;
+                    vector<uint32_t> expected;
+                    for (uint16_t y = 1; y + SYNTHETIC_BASE_RES <= ii.h; y += 2) {
+                        for (uint16_t x = 1; x + SYNTHETIC_BASE_RES <= ii.w; ++x) {
+                            double mean = image_integral_rectangle(ii, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES) / area;
+                            double variance = image_integral_rectangle(sii, x, y, SYNTHETIC_BASE_RES, SYNTHETIC_BASE_RES) / area - mean * mean;
+                            double stdev = (x % 7 == 3) ? 0.0 : sqrt(variance);
+                            uint32_t id = (uint32_t) survivors.size();
+                            survivors.push_back((int64_t) (y * ii.stride) + x, mean, stdev, id);
+                            if (c->classify(ii, x, y, mean, stdev))
+                                expected.push_back(id);
+                        }
+                    }
+
+                    size_t windows = survivors.size();
+                    evaluator.classify_survivors(ii, survivors);
+                    assert(survivors.ids == expected);
+                    assert(!expected.empty() && expected.size() < windows);
+                }
+                simd_set_limit(supported);
+            }
+        }
+
+        // breadth first detection reports the same windows in the same order
+        auto scene = synthetic_scene(320, 240, 1);
+        plant_checker(scene, 100, 60, 24);
+        plant_checker(scene, 200, 120, 48);
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            auto expected = detect(cc, scene, params);
+
+            params.order = DETECT_BREADTH_FIRST;
+            for (unsigned threads : {1u, 3u}) {
+                params.threads = threads;
+                detector d(cc, params);
+                d.detect(scene);
+                size_t heap = heapAllocations;
+                auto& ds = d.detect(scene);
+                assert(heapAllocations == heap);
+                assert(ds.size() == expected.size());
+                for (size_t i = 0; i < ds.size(); ++i)
+                    assert(ds[i].x == expected[i].x && ds[i].y == expected[i].y && ds[i].w == expected[i].w);
+            }
+        }
+    }
+
+    {
+        // coarse to fine scanning only reports windows the exhaustive scan
+        // also reports, still finds the planted objects, and does not depend
+        // on how the rows are split between threads
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            detect_params params;
+            params.mode = mode;
+            auto exhaustive = detect(cc, lum, params);
+
+            for (uint16_t coarse : {2, 3, 4}) {
+                params.coarseStep = coarse;
+                params.threads = 1;
+                detector d(cc, params);
+                d.detect(lum);
+                size_t heap = heapAllocations;
+                auto& ds = d.detect(lum);
+                assert(heapAllocations == heap);
+
+                assert(found(ds, 100, 60, 24, 2));
+                assert(found(ds, 200, 120, 48, 6));
+                assert(ds.size() <= exhaustive.size());
+                for (auto& det : ds) {
+                    bool inExhaustive = false;
+                    for (auto& e : exhaustive)
+                        inExhaustive = inExhaustive || (e.x == det.x && e.y == det.y && e.w == det.w);
+                    assert(inExhaustive);
+                }
+
+                params.threads = 3;
+                auto threaded = detect(cc, lum, params);
+                assert(threaded.size() == ds.size());
+                for (size_t i = 0; i < ds.size(); ++i)
+                    assert(threaded[i].x == ds[i].x && threaded[i].y == ds[i].y && threaded[i].w == ds[i].w);
+            }
+
+            // refining around every coarse window is the exhaustive scan
+            params.coarseStep = 3;
+            params.refineStages = 0;
+            params.threads = 1;
+            auto dense = detect(cc, lum, params);
+            assert(dense.size() == exhaustive.size());
+        }
+    }
+
+    {
+        // grouping reduces the hundreds of hits at every scale around each
+        // planted object to a few groups, with either method
+        auto lum = synthetic_scene(320, 240, 1);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+        auto ds = detect(cc, lum);
+
+        for (auto method : {GROUP_NEIGHBORS, GROUP_NMS}) {
+            group_params params;
+            params.method = method;
+            detection_grouper grouper(params);
+            grouper.group(ds);
+            size_t heap = heapAllocations;
+            auto& groups = grouper.group(ds);
+            assert(heapAllocations == heap);
+
+            assert(groups.size() >= 2 && groups.size() <= 4);
+            bool small = false, large = false;
+            size_t merged = 0;
+            for (auto& g : groups) {
+                small = small || centered_in(g.rect, 100, 60, 24);
+                large = large || centered_in(g.rect, 200, 120, 48);
+                assert(centered_in(g.rect, 100, 60, 24) || centered_in(g.rect, 200, 120, 48));
+                assert(g.neighbors >= params.minNeighbors && g.confidence > 0.0 && g.confidence <= g.neighbors);
+                merged += g.neighbors;
+            }
+            assert(small && large && merged <= ds.size());
+            assert(groups[0].confidence >= groups[1].confidence);
+        }
+
+        // the sweeps find exactly what comparing all pairs finds, on dense
+        // random clusters of every size
+        uint32_t seed = 5;
+        for (int round = 0; round < 20; ++round) {
+            vector<detection> random;
+            for (int i = 0; i < 300; ++i) {
+                seed = seed * 1664525 + 1013904223;
+                uint16_t cluster = (seed >> 8) % 12;
+                uint16_t size = 20 + cluster * 6 + (seed >> 4) % 5;
+                seed = seed * 1664525 + 1013904223;
+                uint16_t x = cluster * 30 + (seed >> 4) % 9;
+                uint16_t y = (cluster % 3) * 40 + (seed >> 12) % 9;
+                random.push_back(detection{x, y, size, size, 0});
+            }
+
+            for (auto method : {GROUP_NEIGHBORS, GROUP_NMS}) {
+                group_params params;
+                params.method = method;
+                params.minNeighbors = round % 4;
+                params.similarity = 0.1 + 0.05 * (round % 3);
+                params.overlap = 0.2 + 0.1 * (round % 5);
+                auto groups = group_detections(random, params);
+                auto expected = naive_groups(random, params);
+                assert(groups.size() == expected.size());
+                for (size_t i = 0; i < groups.size(); ++i) {
+                    assert(groups[i].rect.x == expected[i].rect.x && groups[i].rect.y == expected[i].rect.y);
+                    assert(groups[i].rect.w == expected[i].rect.w && groups[i].rect.h == expected[i].rect.h);
+                    assert(groups[i].neighbors == expected[i].neighbors);
+                    assert(fabs(groups[i].confidence - expected[i].confidence) < 1e-9);
+                }
+            }
+        }
+    }
+
+    {
+        // tiles report the same windows as one pass over the whole image, once
+        // each, when every level steps by one pixel (pixels are integers, so
+        // the integrals are exact)
+        auto lum = synthetic_scene(1100, 420, 3);
+        plant_checker(lum, 40, 30, 24);
+        plant_checker(lum, 270, 100, 40);   // on the first vertical seam
+        plant_checker(lum, 500, 230, 48);   // on the horizontal seam
+        plant_checker(lum, 1050, 380, 30);  // in the corner tile
+
+        detect_params params;
+        params.stepFactor = 0.01;
+        params.maxWindow = 60;
+        auto whole = detect(cc, lum, params);
+
+        tile_params tiles;
+        tiles.tileSize = 300;
+        tiles.maxWindow = 60;
+        tiled_detector td(cc, params, tiles);
+        auto tiled = td.detect(lum.w, lum.h, [&](uint32_t x, uint32_t y, const image_view<double>& tile) {
+            image_blit(image_roi(lum, (uint16_t) x, (uint16_t) y, tile.w, tile.h), tile);
+        });
+
+        auto byPosition = [](const detection& a, const detection& b) {
+            return (a.y != b.y) ? a.y < b.y : (a.x != b.x) ? a.x < b.x : a.w < b.w;
+        };
+        sort(whole.begin(), whole.end(), byPosition);
+        sort(tiled.begin(), tiled.end(), byPosition);
+        assert(!whole.empty() && tiled.size() == whole.size());
+        for (size_t i = 0; i < whole.size(); ++i)
+            assert(tiled[i].x == whole[i].x && tiled[i].y == whole[i].y && tiled[i].w == whole[i].w);
+
+        // an image wider than an image<T> can hold, generated as it is read,
+        // with objects across the 65536 pixel mark and on tile seams
+        struct planted {
+            uint32_t x;
+            uint32_t y;
+            uint16_t size;
+        };
+        vector<planted> objects{{100, 40, 24}, {65520, 60, 36}, {4000, 100, 48}, {69950, 150, 30}};
+        auto reader = [&](uint32_t x0, uint32_t y0, const image_view<double>& tile) {
+            for (uint16_t r = 0; r < tile.h; ++r) {
+                for (uint16_t c = 0; c < tile.w; ++c) {
+                    uint32_t x = x0 + c, y = y0 + r;
+                    uint32_t seed = (x * 2654435761u) ^ (y * 40503u);
+                    seed = seed * 1664525 + 1013904223;
+                    double v = 64 + ((seed >> 16) & 0x7F);
+                    for (auto& o : objects)
+                        if (x >= o.x && x < o.x + o.size && y >= o.y && y < o.y + o.size)
+                            v = ((y - o.y < o.size / 2u) == (x - o.x < o.size / 2u)) ? 40.0 : 215.0;
+                    tile.at(c, r) = v;
+                }
+            }
+        };
+
+        tile_params wide;
+        wide.maxWindow = 64;
+        tiled_detector wd(cc, detect_params(), wide);
+        wd.detect(7000, 240, reader);
+        size_t allocations = wd.allocations();
+        auto& ds = wd.detect(70000, 240, reader);
+        assert(wd.allocations() == allocations);
+
+        for (auto& o : objects)
+            assert(found(ds, o.x, o.y, o.size, o.size / 8 + 1));
+        for (size_t i = 0; i < ds.size(); ++i) {
+            bool inObject = false;
+            for (auto& o : objects)
+                inObject = inObject || centered_in(ds[i], o.x, o.y, o.size);
+            assert(inObject);
+            for (size_t j = 0; j < i; ++j)
+                assert(ds[i].x != ds[j].x || ds[i].y != ds[j].y || ds[i].w != ds[j].w);
+        }
+    }
+
+    {
+        // objects moving a few pixels a frame are followed between keyframes,
+        // one entering mid-stream is picked up at the next keyframe
+        video_params video;
+        video.keyframeInterval = 5;
+        video_detector vd(cc, detect_params(), video);
+
+        auto frame = [](int t, bool entering) {
+            auto lum = synthetic_scene(320, 240, 8);
+            plant_checker(lum, 60 + 2 * t, 50 + t, 24);
+            plant_checker(lum, 220 - 3 * t, 120, 48);
+            if (entering)
+                plant_checker(lum, 150, 180, 32);
+            return lum;
+        };
+        auto covers = [](const vector<detection_group>& groups, uint32_t x, uint32_t y, uint16_t size) {
+            for (auto& g : groups)
+                if (centered_in(g.rect, x, y, size))
+                    return true;
+            return false;
+        };
+
+        for (int t = 0; t < 20; ++t) {
+            auto lum = frame(t, t >= 7);
+            auto& groups = vd.detect(lum);
+            assert(covers(groups, 60 + 2 * t, 50 + t, 24));
+            assert(covers(groups, 220 - 3 * t, 120, 48));
+            assert(covers(groups, 150, 180, 32) == (t >= 10));
+        }
+        assert(vd.frames() == 20 && vd.full_scans() == 4);
+
+        // once the region detectors exist, following the objects does not
+        // allocate
+        vector<image<double>> frames;
+        for (int t = 0; t < 10; ++t)
+            frames.push_back(frame(t, false));
+        vd.reset();
+        for (auto& lum : frames)
+            vd.detect(lum);
+        vd.reset();
+        size_t heap = heapAllocations;
+        for (auto& lum : frames)
+            vd.detect(lum);
+        assert(heapAllocations == heap);
+        assert(vd.full_scans() == 8);
+    }
+
+    {
+        // the search regions of two neighbouring objects overlap, a window
+        // found by both region scans is still grouped once
+        video_params video;
+        video.searchScale = 4.0;
+        video_detector vd(cc, detect_params(), video);
+        auto lum = synthetic_scene(320, 240, 10);
+        plant_checker(lum, 100, 100, 24);
+        plant_checker(lum, 130, 100, 24);
+
+        auto keyframe = vd.detect(lum);
+        auto& tracked = vd.detect(lum);
+        assert(vd.full_scans() == 1 && tracked.size() == keyframe.size());
+        size_t matched = 0;
+        for (auto& t : tracked) {
+            for (auto& k : keyframe) {
+                if (k.rect.x == t.rect.x && k.rect.y == t.rect.y && k.rect.w == t.rect.w) {
+                    assert(t.neighbors == k.neighbors && fabs(t.confidence - k.confidence) < 1e-9);
+                    ++matched;
+                }
+            }
+        }
+        assert(matched == 2);
+    }
+
+    {
+        // a gate lets through exactly the windows of the ungated scan it
+        // leaves open, in every scan order, mode and with coarse to fine
+        auto lum = synthetic_scene(200, 150, 9);
+        auto rc = random_cascade(4);
+        auto mask = image_create_padded<double>(30, 20);
+        uint32_t seed = 3;
+        for (uint16_t y = 0; y < mask.h; ++y) {
+            for (uint16_t x = 0; x < mask.w; ++x) {
+                seed = seed * 1664525 + 1013904223;
+                image_view<double>(mask).at(x, y) = ((seed >> 16) % 3 == 0) ? 1.0 : 0.0;
+            }
+        }
+        auto integral = image_integral(mask);
+        window_gate gate;
+        gate.mask = integral;
+        gate.x = 30;
+        gate.y = 5;
+        gate.cell = 7;
+        gate.minFraction = 0.3;
+
+        struct {
+            detect_mode mode;
+            detect_order order;
+            uint16_t coarseStep;
+            unsigned threads;
+        } configs[] = {
+            {DETECT_SCALE_FEATURES, DETECT_DEPTH_FIRST, 1, 1},
+            {DETECT_SCALE_FEATURES, DETECT_BREADTH_FIRST, 1, 3},
+            {DETECT_SCALE_FEATURES, DETECT_DEPTH_FIRST, 2, 1},
+            {DETECT_PYRAMID, DETECT_DEPTH_FIRST, 3, 3},
+            {DETECT_HYBRID, DETECT_DEPTH_FIRST, 1, 1}
+        };
+        for (auto& config : configs) {
+            detect_params params;
+            params.mode = config.mode;
+            params.order = config.order;
+            params.coarseStep = config.coarseStep;
+            params.threads = config.threads;
+            detector d(rc, params);
+
+            vector<detection> expected;
+            for (auto& det : d.detect(image_roi(lum, 10, 0, 180, 150)))
+                if (gate_open(mask, gate, det))
+                    expected.push_back(det);
+            size_t all = d.detect(image_roi(lum, 10, 0, 180, 150)).size();
+
+            size_t heap = heapAllocations;
+            auto& gated = d.detect(image_roi(lum, 10, 0, 180, 150), gate);
+            assert(heapAllocations == heap);
+            assert(!gated.empty() && gated.size() < all);
+            assert(gated.size() == expected.size());
+            for (size_t i = 0; i < gated.size(); ++i)
+                assert(gated[i].x == expected[i].x && gated[i].y == expected[i].y && gated[i].w == expected[i].w);
+        }
+    }
+
+    {
+        // motion gating: the first frame is scanned whole, a repeated frame
+        // not at all, and then only what moved
+        detector d(cc);
+        for (double rate : {0.0, 0.5}) {
+            motion_params params;
+            params.backgroundRate = rate;
+            motion_gate motion(params);
+
+            auto still = synthetic_scene(320, 240, 10);
+            plant_checker(still, 100, 60, 24);
+            plant_checker(still, 200, 120, 48);
+            auto& first = d.detect(still, motion.update(still));
+            assert(motion.moving() == 1.0);
+            assert(found(first, 100, 60, 24, 0) && found(first, 200, 120, 48, 4));
+
+            assert(d.detect(still, motion.update(still)).empty());
+            assert(motion.moving() == 0.0);
+
+            auto moved = synthetic_scene(320, 240, 10);
+            plant_checker(moved, 100, 60, 24);
+            plant_checker(moved, 180, 110, 48);
+            size_t allocations = d.allocations() + motion.allocations();
+            size_t heap = heapAllocations;
+            auto& ds = d.detect(moved, motion.update(moved));
+            assert(heapAllocations == heap && d.allocations() + motion.allocations() == allocations);
+            assert(motion.moving() > 0.0 && motion.moving() < 0.2);
+            assert(found(ds, 180, 110, 48, 4));
+            for (auto& det : ds)
+                assert(centered_in(det, 180, 110, 48));
+        }
+    }
+
+    {
+        // regions of interest: one region scans exactly like detecting on
+        // that view of the frame
+        auto lum = synthetic_scene(320, 240, 11);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+        detector d(cc);
+
+        detection_mask doorway(1);
+        doorway.set_rois(lum.w, lum.h, {detection{80, 40, 80, 80, 0}});
+        auto expected = detect(cc, image_roi(lum, 80, 40, 80, 80));
+        auto& ds = detect_masked(d, lum, doorway);
+        assert(found(ds, 100, 60, 24, 0) && ds.size() == expected.size());
+        for (size_t i = 0; i < ds.size(); ++i)
+            assert(ds[i].x == expected[i].x && ds[i].y == expected[i].y && ds[i].w == expected[i].w);
+
+        // a pixel mask with two blobs far apart finds both objects and
+        // nothing that sticks out of the blobs
+        auto pixels = image_create_padded<uint8_t>(lum.w, lum.h);
+        image_view<uint8_t> p(pixels);
+        for (uint16_t y = 0; y < p.h; ++y) {
+            for (uint16_t x = 0; x < p.w; ++x) {
+                bool first = x >= 90 && x < 135 && y >= 50 && y < 95;
+                bool second = (x - 224) * (x - 224) + (y - 144) * (y - 144) < 40 * 40;
+                p.at(x, y) = (first || second) ? 1 : 0;
+            }
+        }
+        for (uint16_t cell : {1, 4}) {
+            detection_mask blobs(cell);
+            blobs.set_mask(pixels);
+            uint32_t bx, by, bw, bh;
+            assert(blobs.bounds(bx, by, bw, bh) && bx <= 90 && bx + bw >= 264 && by <= 50 && by + bh >= 184);
+
+            auto& masked = detect_masked(d, lum, blobs);
+            assert(found(masked, 100, 60, 24, 0) && found(masked, 200, 120, 48, 4));
+            // every block under a window has a pixel in the mask
+            for (auto& det : masked) {
+                for (uint32_t y = det.y / cell; y <= (det.y + det.h - 1) / cell; ++y) {
+                    for (uint32_t x = det.x / cell; x <= (det.x + det.w - 1) / cell; ++x) {
+                        bool set = false;
+                        for (uint32_t py = y * cell; py < min((y + 1) * cell, 240u); ++py)
+                            for (uint32_t px = x * cell; px < min((x + 1) * cell, 320u); ++px)
+                                set = set || p.at((uint16_t) px, (uint16_t) py);
+                        assert(set);
+                    }
+                }
+            }
+
+            // the same mask on the next frame does not allocate
+            size_t heap = heapAllocations;
+            detect_masked(d, lum, blobs);
+            assert(heapAllocations == heap);
+        }
+
+        // nothing set, nothing scanned
+        detection_mask empty;
+        empty.set_rois(lum.w, lum.h, {});
+        assert(detect_masked(d, lum, empty).empty());
+    }
+
+    {
+        // anytime detection: resuming in small chunks ends with what one full
+        // scan finds, a window budget stops early with a subset of it
+        auto lum = synthetic_scene(320, 240, 12);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+        auto byPosition = [](const detection& a, const detection& b) {
+            return (a.y != b.y) ? a.y < b.y : (a.x != b.x) ? a.x < b.x : a.w < b.w;
+        };
+        auto same = [](const detection& a, const detection& b) {
+            return a.x == b.x && a.y == b.y && a.w == b.w;
+        };
+
+        for (auto order : {DETECT_DEPTH_FIRST, DETECT_BREADTH_FIRST}) {
+            detect_params params;
+            params.order = order;
+            params.threads = 3;
+            detector d(cc, params);
+            auto full = d.detect(lum);
+            sort(full.begin(), full.end(), byPosition);
+
+            d.begin(lum);
+            size_t calls = 0;
+            while (!d.resume(2000))
+                ++calls;
+            assert(calls > 10 && d.progress() == 1.0);
+            auto resumed = d.found();
+            sort(resumed.begin(), resumed.end(), byPosition);
+            assert(resumed.size() == full.size());
+            for (size_t i = 0; i < full.size(); ++i)
+                assert(same(resumed[i], full[i]));
+
+            // the scales that found the objects go first on the next frame, a
+            // small part of the windows is enough to find both again
+            detect_budget budget;
+            budget.windows = 320 * 240 / 5;
+            auto& partial = d.detect(lum, budget);
+            assert(d.progress() < 0.25);
+            bool small = false, large = false;
+            for (auto& det : partial) {
+                assert(binary_search(full.begin(), full.end(), det, byPosition));
+                small = small || centered_in(det, 100, 60, 24);
+                large = large || centered_in(det, 200, 120, 48);
+            }
+            assert(small && large);
+
+            // a budget spent on the integrals leaves (almost) nothing scanned
+            budget.windows = 0;
+            budget.milliseconds = 1e-6;
+            d.detect(lum, budget);
+            assert(d.progress() < 0.1);
+
+            size_t heap = heapAllocations;
+            d.begin(lum);
+            while (!d.resume(5000)) {
+            }
+            assert(heapAllocations == heap);
+        }
+    }
+
+    {
+        // a batch finds in every frame what detecting on it alone finds, in
+        // the same order, for any number of threads and every mode
+        vector<image<double>> owned;
+        for (uint32_t seed = 20; seed < 25; ++seed) {
+            owned.push_back(synthetic_scene(320, 240, seed));
+            plant_checker(owned.back(), (uint16_t) (40 + 30 * (seed - 20)), 60, 24);
+            plant_checker(owned.back(), 200, (uint16_t) (20 + 25 * (seed - 20)), 48);
+        }
+        vector<image_view<const double>> frames(owned.begin(), owned.end());
+
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID}) {
+            for (unsigned threads : {1u, 3u}) {
+                detect_params params;
+                params.mode = mode;
+                params.threads = threads;
+                detector d(cc, params);
+
+                vector<vector<detection>> expected;
+                for (auto& frame : frames)
+                    expected.push_back(d.detect(frame));
+
+                auto& batch = d.detect(frames);
+                assert(batch.size() == frames.size());
+                for (size_t f = 0; f < frames.size(); ++f) {
+                    assert(!batch[f].empty() && batch[f].size() == expected[f].size());
+                    for (size_t i = 0; i < batch[f].size(); ++i)
+                        assert(batch[f][i].x == expected[f][i].x && batch[f][i].y == expected[f][i].y && batch[f][i].w == expected[f][i].w);
+                }
+
+                // the next batch of the same size does not allocate
+                size_t allocations = d.allocations();
+                size_t heap = heapAllocations;
+                d.detect(frames);
+                assert(heapAllocations == heap && d.allocations() == allocations);
+            }
+        }
+
+        // frames of a batch have to be the same size
+        detector d(cc);
+        bool threw = false;
+        try {
+            d.detect(vector<image_view<const double>>{frames[0], image_roi(owned[1], 0, 0, 100, 100)});
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {
+        // a view of a cascade accepts in the transformed frame exactly the
+        // windows, transformed, that the cascade accepts in the frame (at the
+        // base resolution, where no feature is rounded)
+        auto rc = random_cascade(11);
+        auto lum = synthetic_scene(96, 64, 13);
+        plant_checker(lum, 10, 20, 24);
+        detect_params params;
+        params.maxWindow = SYNTHETIC_BASE_RES;
+
+        for (const cascade_classifier* c : {&cc, &rc}) {
+            auto expected = detect(*c, lum, params);
+            assert(!expected.empty());
+            for (auto t : {VIEW_IDENTITY, VIEW_ROTATE_90, VIEW_ROTATE_180, VIEW_ROTATE_270, VIEW_MIRROR_HORIZONTAL, VIEW_MIRROR_VERTICAL}) {
+                auto ds = detect(c->transformed(t), transformed_image(lum, t), params);
+                vector<pair<uint32_t, uint32_t>> want, got;
+                for (auto& d : expected)
+                    want.push_back(transformed_window(lum.w, lum.h, t, d.x, d.y, d.w));
+                for (auto& d : ds)
+                    got.push_back(make_pair(d.x, d.y));
+                sort(want.begin(), want.end());
+                sort(got.begin(), got.end());
+                assert(want == got);
+            }
+        }
+    }
+
+    {
+        // several cascades share one scan: the detections tagged with each
+        // one are what a detector running it alone finds, in the same order
+        auto lum = synthetic_scene(320, 240, 30);
+        plant_checker(lum, 100, 60, 24);
+        auto patch = image_create<double>(48, 48);
+        plant_checker(patch, 0, 0, 48);
+        auto turned = image_rotate_90(patch);
+        for (uint16_t y = 0; y < 48; ++y)
+            copy(turned.bits.begin() + y * turned.stride, turned.bits.begin() + y * turned.stride + 48, lum.bits.begin() + (120 + y) * lum.stride + 200);
+
+        vector<cascade_classifier> cascades = {cc, cc.transformed(VIEW_ROTATE_90), random_cascade(11)};
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            for (int scan = 0; scan < 4; ++scan) {
+                detect_params params;
+                params.mode = mode;
+                params.threads = (scan % 2) ? 3 : 1;
+                params.order = (scan == 2) ? DETECT_BREADTH_FIRST : DETECT_DEPTH_FIRST;
+                params.coarseStep = (scan == 3) ? 2 : 1;
+                detector d(cascades, params);
+                auto& ds = d.detect(lum);
+
+                for (uint16_t c = 0; c < cascades.size(); ++c) {
+                    detector single(cascades[c], params);
+                    auto& expected = single.detect(lum);
+                    vector<detection> mine;
+                    for (auto& det : ds)
+                        if (det.cascade == c)
+                            mine.push_back(det);
+                    assert(mine.size() == expected.size());
+                    for (size_t i = 0; i < mine.size(); ++i)
+                        assert(mine[i].x == expected[i].x && mine[i].y == expected[i].y && mine[i].w == expected[i].w);
+
+                    // the upright checker for the cascade, the turned one for its view
+                    if (c == 0 && scan != 3)
+                        assert(found(mine, 100, 60, 24, 0) && !found(mine, 200, 120, 48, 4));
+                    if (c == 1 && scan != 3)
+                        assert(found(mine, 200, 120, 48, 4) && !found(mine, 100, 60, 24, 0));
+                }
+
+                size_t allocations = d.allocations();
+                size_t heap = heapAllocations;
+                d.detect(lum);
+                assert(heapAllocations == heap && d.allocations() == allocations);
+            }
+        }
+
+        // all cascades need the same base resolution
+        bool threw = false;
+        try {
+            detector d(vector<cascade_classifier>{cc, cc.scaled(2.0)});
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {
+        // 8 bit pixels in a padded caller buffer are detected on directly,
+        // with the same result as the same luminance as doubles
+        auto lum = synthetic_scene(320, 240, 40);
+        plant_checker(lum, 100, 60, 24);
+        plant_checker(lum, 200, 120, 48);
+        size_t stride = lum.w + 13;
+        vector<uint8_t> buffer(stride * lum.h, 0);
+        for (uint16_t y = 0; y < lum.h; ++y)
+            for (uint16_t x = 0; x < lum.w; ++x)
+                buffer[y * stride + x] = (uint8_t) image_view<const double>(lum).at(x, y);
+
+        for (auto mode : {DETECT_SCALE_FEATURES, DETECT_PYRAMID, DETECT_HYBRID}) {
+            for (unsigned threads : {1u, 3u}) {
+                detect_params params;
+                params.mode = mode;
+                params.threads = threads;
+                detector d(cc, params);
+
+                auto expected = d.detect(lum);
+                auto& ds = d.detect(buffer.data(), lum.w, lum.h, stride);
+                assert(found(ds, 100, 60, 24, 0) && ds.size() == expected.size());
+                for (size_t i = 0; i < ds.size(); ++i)
+                    assert(ds[i].x == expected[i].x && ds[i].y == expected[i].y && ds[i].w == expected[i].w);
+
+                // nothing is allocated for the next frame
+                size_t allocations = d.allocations();
+                size_t heap = heapAllocations;
+                d.detect(buffer.data(), lum.w, lum.h, stride);
+                assert(heapAllocations == heap && d.allocations() == allocations);
+
+                // a region of the buffer reports frame coordinates
+                expected = d.detect(image_roi(lum, 80, 40, 96, 96));
+                auto& region = d.detect(image_view<const uint8_t>(buffer.data() + 40 * stride + 80, 96, 96, stride, 80, 40));
+                assert(found(region, 100, 60, 24, 0) && region.size() == expected.size());
+                for (size_t i = 0; i < region.size(); ++i)
+                    assert(region[i].x == expected[i].x && region[i].y == expected[i].y && region[i].w == expected[i].w);
+            }
+        }
+
+        detector d(cc);
+        bool threw = false;
+        try {
+            d.detect(buffer.data(), lum.w, lum.h, lum.w - 1);
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {
+        // an exception in a task on a pool thread is rethrown by detect on
+        // the calling thread, and the detector can be used again after it
+        auto lum = synthetic_scene(160, 120, 5);
+        plant_checker(lum, 40, 30, 24);
+        detect_params params;
+        params.threads = 3;
+        // no stages, so every window is a detection and every task allocates
+        cascade_classifier everything(SYNTHETIC_BASE_RES);
+        detector d(everything, params);
+
+        failOtherThreads = true;
+        bool threw = false;
+        try {
+            d.detect(lum);
+        } catch (const bad_alloc&) {
+            threw = true;
+        }
+        failOtherThreads = false;
+        assert(threw);
+
+        detector reference(everything);
+        size_t expected = reference.detect(lum).size();
+        assert(expected > 0 && d.detect(lum).size() == expected);
+    }
+
+    return 0;
+}
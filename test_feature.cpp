@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include "feature.h"
+#include "weak_classifier.h"
 
 #include "test_ppm_data.cpp"
 
@@ -43,5 +44,86 @@ int main(int argc, char* argv[]) {
         assert(v2 > v1);
     }
 
+    {
+        // scaled features keep sub-rectangles of equal size inside the window
+        auto f = feature_create(C, 3, 2, 9, 6);
+        assert(feature_area(f) == 54);
+
+        auto g = feature_scaled(f, 1.7, 41);
+        assert(g.width % 3 == 0);
+        assert(g.width == 15);
+        assert(g.height == 10);
+        assert(g.xc + g.width <= 41);
+        assert(g.yc + g.height <= 41);
+        assert(feature_area(g) == 150);
+
+        // clamped to the window
+        auto h = feature_scaled(feature_create(D, 20, 20, 4, 4), 1.3, 31);
+        assert(h.xc + h.width <= 31);
+        assert(h.yc + h.height <= 31);
+    }
+
+    {
+        // three rectangle features stay mean compensated at any scale, so on a
+        // flat image they evaluate to zero
+        auto flat = image_create<double>(64, 64);
+        fill(flat.bits.begin(), flat.bits.end(), 100.0);
+        auto ii = image_integral(flat);
+
+        for (auto type : {C, CT}) {
+            auto f = (type == C) ? feature_create(C, 0, 0, 9, 4) : feature_create(CT, 0, 0, 4, 9);
+            for (double s = 1.0; s < 4.0; s *= 1.25) {
+                uint16_t window = (uint16_t) lround(12 * s);
+                auto below = weak_classifier(f, 0.5, true).scaled(s, window);
+                auto above = weak_classifier(f, -0.5, false).scaled(s, window);
+                assert(below.classify(ii, 0, 0, 100.0, 1.0) == 1);
+                assert(above.classify(ii, 0, 0, 100.0, 1.0) == 1);
+            }
+        }
+    }
+
+    {
+        // a transformed feature on the transformed window measures what the
+        // feature does on the window, up to the sign, and so does a
+        // transformed classifier classify the same, ties included
+        const uint16_t n = 13;
+        auto img = image_create<double>(n, n);
+        uint32_t seed = 7;
+        for (auto& v : img.bits) {
+            seed = seed * 1664525 + 1013904223;
+            v = (seed >> 16) & 0xff;
+        }
+        auto ii = image_integral(img);
+
+        auto transform = [](const image<double>& img, view_transform t) {
+            switch (t) {
+                case VIEW_ROTATE_90: return image_rotate_90(img);
+                case VIEW_ROTATE_180: return image_rotate_180(img);
+                case VIEW_ROTATE_270: return image_rotate_270(img);
+                case VIEW_MIRROR_HORIZONTAL: return image_rotate_180(image_mirror_vertical(img));
+                case VIEW_MIRROR_VERTICAL: return image_mirror_vertical(img);
+                default: return image_copy(img);
+            }
+        };
+        for (auto t : {VIEW_IDENTITY, VIEW_ROTATE_90, VIEW_ROTATE_180, VIEW_ROTATE_270, VIEW_MIRROR_HORIZONTAL, VIEW_MIRROR_VERTICAL}) {
+            auto vii = image_integral(transform(img, t));
+            for (auto& f : generate_feature_set(n)) {
+                int sign;
+                auto g = feature_transformed(f, t, n, sign);
+                assert(g.xc + g.width <= n && g.yc + g.height <= n);
+                assert(feature_area(g) == feature_area(f));
+                double v = feature_value(f, ii, 0, 0);
+                assert(feature_value(g, vii, 0, 0) == sign * v);
+
+                for (double threshold : {v - 0.5, v, v + 0.5}) {
+                    for (bool polarity : {false, true}) {
+                        weak_classifier wc(f, threshold, polarity);
+                        assert(wc.transformed(t, n).classify(vii, 0, 0, 0.0, 1.0) == wc.classify(ii, 0, 0, 0.0, 1.0));
+                    }
+                }
+            }
+        }
+    }
+
     test_destroy();
 }
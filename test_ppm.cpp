@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <assert.h>
 #include "ppm.h"
+#include "utils.h"
+#include <math.h>
 
 #include "test_ppm_data.cpp"
 
@@ -28,7 +30,7 @@ int main(int argc, char* argv[]) {
 
         assert(img.w == 364);
         assert(img.h == 243);
-        assert(img.bits->size() == (img.w * img.h));
+        assert(img.bits.size() == (img.w * img.h));
 
         image_write_ppm(img, "out.ppm");
 
@@ -36,7 +38,7 @@ int main(int argc, char* argv[]) {
 
         assert(img2.w == img.w);
         assert(img2.h == img.h);
-        assert(img2.bits->size() == img.bits->size());
+        assert(img2.bits.size() == img.bits.size());
 
         unlink("out.ppm");
     }
@@ -46,7 +48,7 @@ int main(int argc, char* argv[]) {
 
         assert(img.w == 640);
         assert(img.h == 480);
-        assert(img.bits->size() == img.w * img.h);
+        assert(img.bits.size() == img.w * img.h);
     }
 
     {
@@ -54,7 +56,7 @@ int main(int argc, char* argv[]) {
 
         assert(img.w == 640);
         assert(img.h == 480);
-        assert(img.bits->size() == img.w * img.h);
+        assert(img.bits.size() == img.w * img.h);
     }
 
     {
@@ -160,5 +162,286 @@ int main(int argc, char* argv[]) {
         //image_write_ppm( img2, "blit.ppm" );
     }
 
+    {
+        static_assert(!std::is_copy_constructible<image<double>>::value, "images are move only");
+        static_assert(std::is_nothrow_move_constructible<image<double>>::value, "images move cheaply");
+
+        auto img = image_create<double>(64, 48);
+        const double* pixels = img.bits.data();
+        auto moved = std::move(img);
+        assert(moved.bits.data() == pixels);
+
+        auto copy = image_copy(moved);
+        assert(copy.bits.data() != pixels);
+        assert(copy.bits == moved.bits);
+    }
+
+    {
+        // luminance and integral images are cache line aligned with padded rows
+        auto img = image_create_from_ppm("car.ppm");
+        auto lum = image_argb_to_lum<double>(img);
+        auto ii = image_integral(lum);
+
+        for (auto* p : {&lum, &ii}) {
+            assert(p->w == 364);
+            assert(p->stride >= p->w);
+            assert((p->stride * sizeof (double)) % CACHE_LINE_SIZE == 0);
+            for (uint16_t y = 0; y < p->h; ++y)
+                assert(((uintptr_t) (p->bits.data() + (y * p->stride))) % CACHE_LINE_SIZE == 0);
+        }
+
+        // padding does not change any values
+        auto packedLum = image_create<double>(lum.w, lum.h);
+        image_blit(image_view<const double>(lum), image_view<double>(packedLum));
+        assert(packedLum.stride == packedLum.w);
+        auto packedIi = image_integral(packedLum);
+        for (uint16_t y = 0; y < ii.h; ++y)
+            for (uint16_t x = 0; x < ii.w; ++x)
+                assert(packedIi.bits[(y * packedIi.stride) + x] == ii.bits[(y * ii.stride) + x]);
+        assert(image_integral_rectangle(ii, 17, 33, 100, 80) == image_integral_rectangle(packedIi, 17, 33, 100, 80));
+
+        auto odd = image_create<uint8_t>(33, 7, image_padded_stride<uint8_t>(33));
+        assert(odd.stride == 64);
+        assert(odd.bits.size() == 64 * 7);
+    }
+
+    {
+        // steady state processing through a pool does not allocate
+        auto img = image_create_from_ppm("car.ppm");
+        image_pool<uint32_t> argbPool;
+        image_pool<double> lumPool;
+
+        auto reference = image_integral(image_normalize(image_argb_to_lum<double>(image_resize(img, 200, 150))));
+
+        for (int frame = 0; frame < 5; ++frame) {
+            auto scaled = image_resize(img, 200, 150, &argbPool);
+            auto lum = image_argb_to_lum<double>(scaled, &lumPool);
+            auto norm = image_normalize(lum, &lumPool);
+            auto ii = image_integral(norm, &lumPool);
+            auto r90 = image_rotate_90(lum, &lumPool);
+            auto mirror = image_mirror_vertical(lum, &lumPool);
+
+            for (uint16_t y = 0; y < ii.h; ++y)
+                for (uint16_t x = 0; x < ii.w; ++x)
+                    assert(ii.bits[(y * ii.stride) + x] == reference.bits[(y * reference.stride) + x]);
+
+            argbPool.release(std::move(scaled));
+            for (auto* p : {&lum, &norm, &ii, &r90, &mirror})
+                lumPool.release(std::move(*p));
+
+            assert(argbPool.allocations() == 1);
+            assert(lumPool.allocations() == 5);
+            assert(lumPool.cached() == 5);
+        }
+
+        // buffers are shared between sizes that land in the same bucket
+        image_pool<double> pool;
+        pool.release(pool.create(100, 100));
+        auto smaller = pool.create(96, 96);
+        assert(pool.allocations() == 1);
+        assert(smaller.stride == 96);
+        assert(smaller.bits.size() == 96 * 96);
+
+        pool.clear();
+        assert(pool.cached() == 0);
+    }
+
+    {
+        // single channel resize keeps flat regions flat and ramps monotonic
+        auto ramp = image_create_padded<double>(200, 100);
+        for (uint16_t y = 0; y < ramp.h; ++y)
+            for (uint16_t x = 0; x < ramp.w; ++x)
+                ramp.bits[(y * ramp.stride) + x] = (x < 100) ? 50.0 : 50.0 + (x - 100);
+
+        auto small = image_resize_lum(ramp, 80, 40);
+        assert(small.w == 80);
+        assert(small.h == 40);
+        for (uint16_t y = 0; y < small.h; ++y) {
+            for (uint16_t x = 0; x < small.w; ++x) {
+                double v = small.bits[(y * small.stride) + x];
+                if (x < 39)
+                    assert(v == 50.0);
+                if (x > 0)
+                    assert(v >= small.bits[(y * small.stride) + x - 1]);
+                assert(v >= 50.0 && v <= 149.0);
+            }
+        }
+    }
+
+    {
+        // area averaging: flat stays flat and fine detail averages out instead
+        // of aliasing
+        auto checker = image_create_padded<float>(333, 201);
+        for (uint16_t y = 0; y < checker.h; ++y)
+            for (uint16_t x = 0; x < checker.w; ++x)
+                checker.bits[(y * checker.stride) + x] = ((x + y) % 2) ? 255.0f : 0.0f;
+
+        auto small = image_downscale_area(checker, 61, 37);
+        for (uint16_t y = 0; y < small.h; ++y)
+            for (uint16_t x = 0; x < small.w; ++x)
+                assert(fabs(small.bits[(y * small.stride) + x] - 127.5f) < 15.0f);
+
+        auto flat = image_create<double>(100, 80);
+        fill(flat.bits.begin(), flat.bits.end(), 42.0);
+        auto flatSmall = image_downscale_area(flat, 30, 17);
+        for (uint16_t y = 0; y < flatSmall.h; ++y)
+            for (uint16_t x = 0; x < flatSmall.w; ++x)
+                assert(fabs(flatSmall.bits[(y * flatSmall.stride) + x] - 42.0) < 1e-4);
+
+        // the plan can be reused for any number of images of the same size
+        auto plan = image_area_plan_create(100, 80, 30, 17);
+        auto out = image_create<double>(30, 17);
+        image_downscale_area(image_view<const double>(flat), image_view<double>(out), plan);
+        image_downscale_area(image_view<const double>(flat), image_view<double>(out), plan);
+        assert(fabs(out.bits[0] - 42.0) < 1e-4);
+    }
+
+    {
+        // 2x decimation: the SSE kernels match the plain definition, and area
+        // averaging by exactly 2x agrees with it
+        auto img = image_create_from_ppm("car.ppm");
+        auto lum8 = image_argb_to_lum<uint8_t>(img);
+        auto half8 = image_downscale_2x(lum8);
+        assert(half8.w == img.w / 2);
+        assert(half8.h == img.h / 2);
+        for (uint16_t y = 0; y < half8.h; ++y) {
+            for (uint16_t x = 0; x < half8.w; ++x) {
+                int sum = lum8.bits[(2 * y * lum8.stride) + 2 * x] + lum8.bits[(2 * y * lum8.stride) + 2 * x + 1] +
+                        lum8.bits[((2 * y + 1) * lum8.stride) + 2 * x] + lum8.bits[((2 * y + 1) * lum8.stride) + 2 * x + 1];
+                assert(half8.bits[(y * half8.stride) + x] == (sum + 2) / 4);
+            }
+        }
+
+        auto lumf = image_argb_to_lum<float>(img);
+        auto halff = image_downscale_2x(lumf);
+        auto aread = image_downscale_area(image_roi(lumf, 0, 0, lumf.w & ~1, lumf.h & ~1), lumf.w / 2, lumf.h / 2);
+        for (uint16_t y = 0; y < halff.h; ++y) {
+            for (uint16_t x = 0; x < halff.w; ++x) {
+                float sum = (lumf.bits[(2 * y * lumf.stride) + 2 * x] + lumf.bits[((2 * y + 1) * lumf.stride) + 2 * x]) +
+                        (lumf.bits[(2 * y * lumf.stride) + 2 * x + 1] + lumf.bits[((2 * y + 1) * lumf.stride) + 2 * x + 1]);
+                assert(halff.bits[(y * halff.stride) + x] == sum * 0.25f);
+                assert(fabs(aread.bits[(y * aread.stride) + x] - halff.bits[(y * halff.stride) + x]) < 1e-3);
+            }
+        }
+    }
+
+    {
+        auto img = image_create_from_ppm("car.ppm");
+        auto roi = image_roi(img, 30, 20, 200, 150);
+
+        assert(roi.w == 200);
+        assert(roi.h == 150);
+        assert(roi.x == 30);
+        assert(roi.y == 20);
+        assert(roi.stride == img.w);
+        assert(roi.at(0, 0) == img.bits[(20 * img.w) + 30]);
+
+        // a roi of a roi keeps track of its origin in the original image
+        auto inner = image_roi(roi, 10, 5, 50, 50);
+        assert(inner.x == 40);
+        assert(inner.y == 25);
+        assert(&inner.at(0, 0) == &img.bits[(25 * img.w) + 40]);
+
+        bool threw = false;
+        try {
+            image_roi(roi, 190, 0, 20, 10);
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {
+        // transforms on a view match transforms on a copied crop
+        auto img = image_create_from_ppm("car.ppm");
+        auto crop = image_create<uint32_t>(200, 150);
+        image_blit(img, 30, 20, 200, 150, crop, 0, 0);
+        auto roi = image_roi(img, 30, 20, 200, 150);
+
+        auto lum = image_argb_to_lum<double>(crop);
+        auto roiLum = image_argb_to_lum<double>(roi);
+        assert(lum.bits == roiLum.bits);
+
+        auto lumView = image_roi(lum, 0, 0, lum.w, lum.h);
+        assert(image_integral(lum).bits == image_integral(lumView).bits);
+        assert(image_squared_integral(lum).bits == image_squared_integral(lumView).bits);
+        assert(image_normalize(lum).bits == image_normalize(lumView).bits);
+        assert(image_resize(crop, 100, 75).bits == image_resize(roi, 100, 75).bits);
+        assert(image_rotate_90(crop).bits == image_rotate_90(roi).bits);
+        assert(image_mirror_vertical(crop).bits == image_mirror_vertical(roi).bits);
+        assert(image_copy(roi).bits == crop.bits);
+
+        // integral of a sub-window of the luminance image
+        auto fullLum = image_argb_to_lum<double>(img);
+        auto ii = image_integral(image_roi(fullLum, 30, 20, 200, 150));
+        assert(ii.bits == image_integral(lum).bits);
+    }
+
+    {
+        // resizing into a view writes only the viewed pixels
+        auto img = image_create_from_ppm("car.ppm");
+        auto boxed = image_create<uint32_t>(64, 64);
+        image_resize(image_view<const uint32_t>(img), image_roi(boxed, 0, 11, 64, 42));
+        auto scaled = image_resize(img, 64, 42);
+
+        for (uint16_t y = 0; y < 64; ++y) {
+            for (uint16_t x = 0; x < 64; ++x) {
+                uint32_t v = boxed.bits[(y * 64) + x];
+                if (y < 11 || y >= 53)
+                    assert(v == 0);
+                else assert(v == scaled.bits[((y - 11) * 64) + x]);
+            }
+        }
+    }
+
+    {
+        // every resize kernel produces the same pixels; 7 bit weights keep each
+        // channel within two steps of an exact bilinear blend at the same
+        // sample positions and rounding keeps the average error well below
+        // the half step the old truncating float version had
+        auto img = image_create_from_ppm("car.ppm");
+        const uint16_t sizes[][2] = {{32, 32}, {101, 67}, {1616, 1080}, {3, 1}};
+
+        for (auto& size : sizes) {
+            uint16_t ow = size[0], oh = size[1];
+            simd_set_limit(SIMD_NONE);
+            auto scalar = image_resize(img, ow, oh);
+            simd_set_limit(SIMD_SSE2);
+            auto sse2 = image_resize(img, ow, oh);
+            simd_set_limit(SIMD_AVX512);
+            auto best = image_resize(img, ow, oh);
+            assert(scalar.bits == sse2.bits);
+            assert(scalar.bits == best.bits);
+
+            float xr = ((float) (img.w - 1)) / ow, yr = ((float) (img.h - 1)) / oh;
+            double totalError = 0;
+            for (uint16_t i = 0; i < oh; ++i) {
+                for (uint16_t j = 0; j < ow; ++j) {
+                    int x = (int) (xr * j), y = (int) (yr * i);
+                    double xd = (xr * j) - x, yd = (yr * i) - y;
+                    const uint32_t* src = img.bits.data() + (y * img.stride) + x;
+                    uint32_t v = scalar.bits[(i * scalar.stride) + j];
+                    assert((v >> 24) == 0xff);
+                    for (int shift = 0; shift < 24; shift += 8) {
+                        double exact = ((src[0] >> shift) & 0xff)*(1 - xd)*(1 - yd) + ((src[1] >> shift) & 0xff) * xd * (1 - yd) +
+                                ((src[img.stride] >> shift) & 0xff)*(1 - xd) * yd + ((src[img.stride + 1] >> shift) & 0xff) * xd*yd;
+                        double error = fabs(exact - ((v >> shift) & 0xff));
+                        assert(error <= 2.0);
+                        totalError += error;
+                    }
+                }
+            }
+            assert(totalError / (3.0 * ow * oh) < 0.35);
+        }
+
+        // degenerate single column / row inputs replicate the sample
+        auto column = image_create<uint32_t>(1, 5);
+        std::fill(column.bits.begin(), column.bits.end(), 0xff123456);
+        auto wide = image_resize(column, 7, 3);
+        for (uint16_t i = 0; i < 3; ++i)
+            for (uint16_t j = 0; j < 7; ++j)
+                assert(wide.bits[(i * wide.stride) + j] == 0xff123456);
+    }
+
     test_destroy();
 }
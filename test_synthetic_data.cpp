@@ -0,0 +1,56 @@
+#include "cascade_classifier.h"
+#include <stdint.h>
+
+// A hand built cascade for tests and benchmarks. It accepts a 2x2 checkerboard
+// (dark top left and bottom right quadrants, bright top right and bottom left)
+// filling a 24x24 window. The first stage is loose so that a few percent of
+// noise windows survive it, the later stages are strict.
+const uint16_t SYNTHETIC_BASE_RES = 24;
+
+cascade_classifier synthetic_cascade() {
+    cascade_classifier cc(SYNTHETIC_BASE_RES);
+
+    cc.push_back(strong_classifier({
+        weak_classifier(feature_create(D, 0, 0, 24, 24), 48.0, false)
+    },
+    {1.0}, 0.5));
+
+    cc.push_back(strong_classifier({
+        weak_classifier(feature_create(D, 0, 0, 24, 24), 200.0, false),
+        weak_classifier(feature_create(A, 0, 0, 24, 24), 150.0, true),
+        weak_classifier(feature_create(A, 0, 0, 24, 24), -150.0, false),
+        weak_classifier(feature_create(B, 0, 0, 24, 24), 150.0, true),
+        weak_classifier(feature_create(B, 0, 0, 24, 24), -150.0, false)
+    },
+    {2.0, 1.0, 1.0, 1.0, 1.0}, 4.0));
+
+    cc.push_back(strong_classifier({
+        weak_classifier(feature_create(A, 0, 0, 24, 12), 100.0, false),
+        weak_classifier(feature_create(A, 0, 12, 24, 12), -100.0, true)
+    },
+    {1.0, 1.0}, 1.5));
+
+    return cc;
+}
+
+// Uniform noise in [64, 192) from a fixed LCG so every run sees the same scene.
+image<double> synthetic_scene(uint16_t w, uint16_t h, uint32_t seed) {
+    auto img = image_create_padded<double>(w, h);
+    for (uint16_t y = 0; y < h; ++y) {
+        for (uint16_t x = 0; x < w; ++x) {
+            seed = seed * 1664525 + 1013904223;
+            img.bits[(y * img.stride) + x] = 64 + ((seed >> 16) & 0x7F);
+        }
+    }
+    return img;
+}
+
+void plant_checker(image<double>& img, uint16_t x, uint16_t y, uint16_t size) {
+    uint16_t half = size / 2;
+    for (uint16_t r = 0; r < size; ++r) {
+        for (uint16_t c = 0; c < size; ++c) {
+            bool dark = (r < half) == (c < half);
+            img.bits[((y + r) * img.stride) + x + c] = dark ? 40.0 : 215.0;
+        }
+    }
+}
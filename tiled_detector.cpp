@@ -0,0 +1,87 @@
+
+#include "tiled_detector.h"
+
+using namespace std;
+
+tiled_detector::tiled_detector(const cascade_classifier& cc, const detect_params& params, const tile_params& tiles) :
+_tiles(tiles),
+_detector(cc, _detector_params(params, tiles)),
+_tile(),
+_xs(),
+_ys(),
+_xSplits(),
+_ySplits(),
+_detections(),
+_allocations(0) {
+}
+
+tiled_detector::~tiled_detector() noexcept {
+}
+
+// The tile overlap only covers windows up to maxWindow, the detector must not
+// look for larger ones.
+detect_params tiled_detector::_detector_params(detect_params params, const tile_params& tiles) {
+    if (tiles.maxWindow == 0 || tiles.maxWindow >= tiles.tileSize)
+        throw runtime_error("tiled_detector maxWindow must be between 1 and tileSize - 1.");
+
+    if (params.maxWindow == 0 || params.maxWindow > tiles.maxWindow)
+        params.maxWindow = tiles.maxWindow;
+    return params;
+}
+
+// Tile origins along one axis: every tile - overlap pixels, with the last tile
+// moved back to end at the border. splits holds twice the middle of the
+// overlap between each tile and the next.
+void tiled_detector::_layout(uint32_t size, uint16_t tile, uint16_t overlap, vector<uint32_t>& origins, vector<uint64_t>& splits) {
+    origins.clear();
+    splits.clear();
+    if (size <= tile) {
+        origins.push_back(0);
+        return;
+    }
+
+    uint32_t stride = tile - overlap;
+    for (uint32_t o = 0; o + tile < size; o += stride)
+        origins.push_back(o);
+    origins.push_back(size - tile);
+
+    for (size_t k = 1; k < origins.size(); ++k)
+        splits.push_back((uint64_t) origins[k - 1] + tile + origins[k]);
+}
+
+const vector<detection>& tiled_detector::detect(uint32_t w, uint32_t h, const tile_reader& read) {
+    if (w >= (1u << 31) || h >= (1u << 31))
+        throw runtime_error("tiled_detector image too large.");
+
+    uint16_t tw = (uint16_t) min((uint32_t) _tiles.tileSize, w);
+    uint16_t th = (uint16_t) min((uint32_t) _tiles.tileSize, h);
+    if (_tile.w != tw || _tile.h != th) {
+        _tile = image_create_padded<double>(tw, th);
+        ++_allocations;
+    }
+
+    _layout(w, _tiles.tileSize, _tiles.maxWindow, _xs, _xSplits);
+    _layout(h, _tiles.tileSize, _tiles.maxWindow, _ys, _ySplits);
+
+    _detections.clear();
+    for (size_t ty = 0; ty < _ys.size(); ++ty) {
+        for (size_t tx = 0; tx < _xs.size(); ++tx) {
+            read(_xs[tx], _ys[ty], image_view<double>(_tile));
+
+            for (auto& d : _detector.detect(_tile)) {
+                detection frame{_xs[tx] + d.x, _ys[ty] + d.y, d.w, d.h, d.cascade};
+
+                // keep the window only in the tile its center belongs to
+                uint64_t cx = 2 * (uint64_t) frame.x + frame.w;
+                uint64_t cy = 2 * (uint64_t) frame.y + frame.h;
+                if ((tx > 0 && cx < _xSplits[tx - 1]) || (tx + 1 < _xs.size() && cx >= _xSplits[tx]))
+                    continue;
+                if ((ty > 0 && cy < _ySplits[ty - 1]) || (ty + 1 < _ys.size() && cy >= _ySplits[ty]))
+                    continue;
+                _detections.push_back(frame);
+            }
+        }
+    }
+
+    return _detections;
+}
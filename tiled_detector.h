@@ -0,0 +1,72 @@
+
+#ifndef __tiled_detector_h
+#define __tiled_detector_h
+
+#include "detector.h"
+#include <functional>
+
+struct tile_params {
+    // Side of a tile in pixels.
+    uint16_t tileSize = 2048;
+    // Largest window searched, neighbouring tiles overlap by at least this
+    // much so every window fits whole in some tile. Has to be less than
+    // tileSize.
+    uint16_t maxWindow = 256;
+};
+
+// Detection on images of any size (up to 2^31 pixels a side), with memory
+// bounded by the tile size rather than the image size. The image is read a
+// tile at a time through a callback, into one reused tile buffer, and one
+// detector scans every tile with its own integrals. Tiles are laid out on a
+// grid with an overlap of at least maxWindow; the overlap is split down the
+// middle and a tile only reports windows whose center falls on its side of
+// every split, so each window is reported by exactly one tile and nothing is
+// lost or doubled on the seams. A window of up to maxWindow pixels whose
+// center is on a tile's side fits in that tile.
+//
+// All tiles have the same size (the last row and column of tiles are moved
+// back to end at the image border), so after the first tile the detector
+// does not allocate again and peak memory does not depend on the image size.
+// With stepFactor small enough that every level steps by one pixel, and
+// integer valued pixels, the result holds the same windows as detecting on
+// the whole image would.
+class tiled_detector {
+public:
+    // Fills tile with the pixels of the image from (x, y) on, tile.w x tile.h
+    // of them.
+    typedef std::function<void(uint32_t x, uint32_t y, const image_view<double>& tile)> tile_reader;
+
+    tiled_detector(const cascade_classifier& cc,
+            const detect_params& params = detect_params(),
+            const tile_params& tiles = tile_params());
+    ~tiled_detector() noexcept;
+
+    // Detect in a w x h image read through read, in image coordinates, tile
+    // by tile (row major). The result stays valid until the next call.
+    const std::vector<detection>& detect(uint32_t w, uint32_t h, const tile_reader& read);
+
+    // Image sized buffers (re)allocated by the detector and for the tile, see
+    // detector::allocations. The tile layout and the result grow with the
+    // image, everything else depends on the tile size only.
+    size_t allocations() const {
+        return _detector.allocations() + _allocations;
+    }
+
+private:
+    static detect_params _detector_params(detect_params params, const tile_params& tiles);
+    static void _layout(uint32_t size, uint16_t tile, uint16_t overlap, std::vector<uint32_t>& origins, std::vector<uint64_t>& splits);
+
+    tile_params _tiles;
+    detector _detector;
+    image<double> _tile;
+    std::vector<uint32_t> _xs;
+    std::vector<uint32_t> _ys;
+    // twice the coordinate of the middle of every overlap, a window belongs
+    // to the tile on its side of the ones around it
+    std::vector<uint64_t> _xSplits;
+    std::vector<uint64_t> _ySplits;
+    std::vector<detection> _detections;
+    size_t _allocations;
+};
+
+#endif
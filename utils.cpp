@@ -26,3 +26,27 @@ vector<string> get_ppm_file_paths(const string& path) {
 
     return names;
 }
+
+static simd_level _simd_limit = SIMD_AVX512;
+
+static simd_level _simd_detect() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#endif
+    return SIMD_NONE;
+}
+
+simd_level simd_supported() {
+    static const simd_level detected = _simd_detect();
+    return (detected < _simd_limit) ? detected : _simd_limit;
+}
+
+void simd_set_limit(simd_level level) {
+    _simd_limit = level;
+}
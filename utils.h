@@ -6,4 +6,15 @@
 
 std::vector<std::string> get_ppm_file_paths(const std::string& path);
 
+enum simd_level {
+    SIMD_NONE, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512
+};
+
+// Best SIMD instruction set this CPU supports, capped by simd_set_limit().
+// Kernels with SIMD variants use this to pick one at runtime.
+simd_level simd_supported();
+
+// Cap the level simd_supported() reports, e.g. to test scalar fallbacks.
+void simd_set_limit(simd_level level);
+
 #endif
@@ -0,0 +1,126 @@
+
+#include "video_detector.h"
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+using namespace std;
+
+// Region detectors kept around, the least recently used one goes first.
+static const size_t MAX_REGION_DETECTORS = 16;
+
+video_detector::video_detector(const cascade_classifier& cc, const detect_params& params, const video_params& video) :
+_cascades(std::make_shared<const cascade_scales>(cc, detect_cascade_scales(params, cc.get_base_resolution()))),
+_params(params),
+_video(video),
+_full(_cascades, params),
+_grouper(video.grouping),
+_regions(),
+_hits(),
+_tracks(),
+_frames(0),
+_sinceKeyframe(0),
+_fullScans(0) {
+    if (video.searchScale < 1.0 || video.scaleSlack < 1.0)
+        throw runtime_error("video_detector searchScale and scaleSlack must be at least 1.");
+}
+
+video_detector::~video_detector() noexcept {
+}
+
+void video_detector::reset() {
+    _tracks.clear();
+}
+
+// Detector for regions of w x h, searching the window sizes of an object the
+// region was sized for.
+detector& video_detector::_region_detector(uint16_t w, uint16_t h) {
+    for (auto& r : _regions) {
+        if (r.w == w && r.h == h) {
+            r.lastUsed = _frames;
+            return *r.d;
+        }
+    }
+
+    if (_regions.size() >= MAX_REGION_DETECTORS) {
+        auto oldest = min_element(_regions.begin(), _regions.end(), [](const region_detector& a, const region_detector& b) {
+            return a.lastUsed < b.lastUsed;
+        });
+        _regions.erase(oldest);
+    }
+
+    double size = max(w, h) / _video.searchScale;
+    detect_params params = _params;
+    params.threads = 1;
+    params.minWindow = (uint16_t) floor(size / _video.scaleSlack);
+    params.maxWindow = (uint16_t) min(ceil(size * _video.scaleSlack), (double) UINT16_MAX);
+    _regions.push_back(region_detector{w, h, _frames, unique_ptr<detector>(new detector(_cascades, params))});
+    return *_regions.back().d;
+}
+
+// Search around every tracked object. Returns false if one of them is lost,
+// or does not fit in the frame with the room around it.
+bool video_detector::_track(const image_view<const double>& lum) {
+    _hits.clear();
+    for (auto& t : _tracks) {
+        uint32_t side = (uint32_t) ceil(max(t.rect.w, t.rect.h) * _video.searchScale / 8) * 8;
+        if (side > lum.w || side > lum.h)
+            return false;
+
+        // centered on the object, moved inside the frame at its borders
+        int64_t cx = (int64_t) t.rect.x + t.rect.w / 2 - lum.x;
+        int64_t cy = (int64_t) t.rect.y + t.rect.h / 2 - lum.y;
+        uint16_t x = (uint16_t) min(max(cx - (int64_t) side / 2, (int64_t) 0), (int64_t) (lum.w - side));
+        uint16_t y = (uint16_t) min(max(cy - (int64_t) side / 2, (int64_t) 0), (int64_t) (lum.h - side));
+
+        auto& ds = _region_detector((uint16_t) side, (uint16_t) side).detect(image_roi(lum, x, y, (uint16_t) side, (uint16_t) side));
+        _hits.insert(_hits.end(), ds.begin(), ds.end());
+    }
+
+    // the regions of nearby objects overlap, and a window scanned by several
+    // of them would count as several neighbours of its group
+    if (_tracks.size() > 1) {
+        sort(_hits.begin(), _hits.end(), [](const detection& a, const detection& b) {
+            return tie(a.y, a.x, a.h, a.w) < tie(b.y, b.x, b.h, b.w);
+        });
+        _hits.erase(unique(_hits.begin(), _hits.end(), [](const detection& a, const detection& b) {
+            return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+        }), _hits.end());
+    }
+
+    auto& groups = _grouper.group(_hits);
+
+    // every object has to be found again with enough confidence, somewhere
+    // near where it was
+    for (auto& t : _tracks) {
+        bool found = false;
+        for (auto& g : groups) {
+            int64_t dx = ((int64_t) g.rect.x + g.rect.w / 2) - ((int64_t) t.rect.x + t.rect.w / 2);
+            int64_t dy = ((int64_t) g.rect.y + g.rect.h / 2) - ((int64_t) t.rect.y + t.rect.h / 2);
+            double reach = max(t.rect.w, t.rect.h) * _video.searchScale / 2;
+            if (fabs((double) dx) <= reach && fabs((double) dy) <= reach && g.confidence >= _video.minConfidenceRatio * t.confidence) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+
+    _tracks.assign(groups.begin(), groups.end());
+    return true;
+}
+
+const vector<detection_group>& video_detector::detect(const image_view<const double>& lum) {
+    ++_frames;
+
+    bool keyframe = _tracks.empty() || _sinceKeyframe + 1 >= _video.keyframeInterval;
+    if (keyframe || !_track(lum)) {
+        auto& groups = _grouper.group(_full.detect(lum));
+        _tracks.assign(groups.begin(), groups.end());
+        _sinceKeyframe = 0;
+        ++_fullScans;
+    } else ++_sinceKeyframe;
+
+    return _tracks;
+}
@@ -0,0 +1,85 @@
+
+#ifndef __video_detector_h
+#define __video_detector_h
+
+#include "detector.h"
+#include "grouping.h"
+
+struct video_params {
+    // Every keyframeInterval'th frame is scanned whole, so objects that
+    // enter the picture are picked up.
+    unsigned keyframeInterval = 10;
+    // Side of the region searched around a tracked object, relative to the
+    // object's size. Has to leave room for the motion between two frames.
+    double searchScale = 2.0;
+    // Window sizes searched in a region, from size / scaleSlack to size *
+    // scaleSlack of the tracked object.
+    double scaleSlack = 1.6;
+    // A tracked object counts as lost when nothing is found in its region,
+    // or what is found has less than this fraction of its confidence. A lost
+    // object makes the frame a full scan.
+    double minConfidenceRatio = 0.5;
+    // How the hits of each frame are grouped into objects.
+    group_params grouping;
+};
+
+// Detection on a video stream, where objects only move a little from one
+// frame to the next. Keyframes are scanned whole and their detections grouped
+// into tracked objects. Until the next keyframe only a region around every
+// tracked object is scanned, at window sizes close to the object's, and the
+// groups found there become the tracked objects of the next frame. As soon as
+// an object is lost the frame is scanned whole after all, so losing track
+// costs speed, not recall; objects that appear between keyframes are found at
+// the next keyframe.
+//
+// Regions are fixed to a multiple of 8 pixels in size and scanned by
+// detectors kept per region size, sharing one set of scaled cascades, so in
+// steady state no buffers are allocated.
+class video_detector {
+public:
+    video_detector(const cascade_classifier& cc,
+            const detect_params& params = detect_params(),
+            const video_params& video = video_params());
+    ~video_detector() noexcept;
+
+    // Detect in the next frame of the stream. The result stays valid until
+    // the next call.
+    const std::vector<detection_group>& detect(const image_view<const double>& lum);
+
+    // Forget the tracked objects, the next frame is scanned whole.
+    void reset();
+
+    // Frames seen, and how many of them were scanned whole.
+    size_t frames() const {
+        return _frames;
+    }
+
+    size_t full_scans() const {
+        return _fullScans;
+    }
+
+private:
+    struct region_detector {
+        uint16_t w;
+        uint16_t h;
+        uint64_t lastUsed;
+        std::unique_ptr<detector> d;
+    };
+
+    detector& _region_detector(uint16_t w, uint16_t h);
+    bool _track(const image_view<const double>& lum);
+
+    std::shared_ptr<const cascade_scales> _cascades;
+    detect_params _params;
+    video_params _video;
+    detector _full;
+    detection_grouper _grouper;
+    std::vector<region_detector> _regions;
+    std::vector<detection> _hits;
+    std::vector<detection_group> _tracks;
+    size_t _frames;
+    size_t _sinceKeyframe;
+    size_t _fullScans;
+};
+
+#endif
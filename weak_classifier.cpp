@@ -101,15 +101,18 @@ double weak_classifier::find_optimum_threshold(const std::vector<double>& fvals,
     return minerror;
 }
 
-int weak_classifier::classify(const image<double>& img,
+int weak_classifier::classify(const image_view<const double>& img,
         uint16_t x,
         uint16_t y,
         double mean,
-        double stdev) {
+        double stdev) const {
     double fval = feature_value(_f, img, x, y);
 
-    if (_f.type == C || _f.type == CT)
-        fval += _f.width * _f.height * mean / 3;
+    // three rectangle features weigh one third of their area negatively
+    if (_f.type == C)
+        fval += (_f.width / 3) * _f.height * mean;
+    else if (_f.type == CT)
+        fval += _f.width * (_f.height / 3) * mean;
 
     if (stdev != 0.0)
         fval /= stdev;
@@ -123,3 +126,19 @@ void weak_classifier::scale(double s) {
     feature_scale(_f, s);
     _threshold *= pow(s, 2);
 }
+
+weak_classifier weak_classifier::scaled(double s, uint16_t window) const {
+    feature f = feature_scaled(_f, s, window);
+    double areaRatio = (double) feature_area(f) / (double) feature_area(_f);
+    return weak_classifier(f, _threshold * areaRatio, _polarity);
+}
+
+weak_classifier weak_classifier::transformed(view_transform t, uint16_t window) const {
+    int sign;
+    feature f = feature_transformed(_f, t, window, sign);
+    if (sign > 0)
+        return weak_classifier(f, _threshold, _polarity);
+
+    // -v < threshold has to hold exactly when v >= _threshold does
+    return weak_classifier(f, nextafter(-_threshold, INFINITY), !_polarity);
+}
@@ -7,6 +7,10 @@
 #include <string>
 #include <vector>
 
+// Evaluation (classify and the get_* accessors) is const and only reads the
+// classifier and the integral image passed in, so one classifier can be
+// evaluated from any number of threads at once as long as nobody modifies it
+// (find_optimum_threshold, scale) at the same time.
 class weak_classifier {
 public:
     weak_classifier(const feature& f = feature(), double threshold = 0.0, bool polarity = true);
@@ -17,14 +21,36 @@ public:
             size_t nfsize,
             const std::vector<double>& weights);
 
-    int classify(const image<double>& img,
+    int classify(const image_view<const double>& img,
             uint16_t x,
             uint16_t y,
             double mean,
-            double stdev);
+            double stdev) const;
 
     void scale(double s);
 
+    // Copy of this classifier for a window s times larger (see feature_scaled).
+    // The threshold is scaled by the ratio of the areas actually covered
+    // rather than by s^2, so rounding of the feature is compensated for.
+    weak_classifier scaled(double s, uint16_t window) const;
+
+    // Copy of this classifier for windows transformed by t (see
+    // feature_transformed). A negated feature flips the threshold and the
+    // polarity, so every window is classified as its transformed self was.
+    weak_classifier transformed(view_transform t, uint16_t window) const;
+
+    const feature& get_feature() const {
+        return _f;
+    }
+
+    double get_threshold() const {
+        return _threshold;
+    }
+
+    bool get_polarity() const {
+        return _polarity;
+    }
+
 private:
     feature _f;
     double _threshold;